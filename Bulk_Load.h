@@ -0,0 +1,135 @@
+#ifndef _BULK_LOAD_H_
+#define _BULK_LOAD_H_
+
+#include <pthread.h>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Builds a perfectly balanced BST out of a set of keys, for either tree.
+ *
+ * The keys are sorted and deduplicated in place. The top levels of the tree
+ * split the keys into one subtree per thread; each thread builds its
+ * subtree on its own, and the calling thread then links the top levels to
+ * the subtree roots. Nothing is visible to the tree until the caller
+ * publishes the returned root.
+ *
+ * Node must provide, through Ops:
+ *	static Node *make(int key, int thread_num);
+ *	static void link(Node *parent, Node *left, Node *right);
+ * where left/right are NULL for an empty child.
+ */
+template <typename Node, typename Ops>
+class Bulk_Loader {
+	private:
+	struct Subtree {
+		Bulk_Loader *loader;
+		size_t lo, hi;		// [lo, hi) in keys
+		int thread_num;
+		Node *root;
+	};
+
+	const std::vector<int> &keys;
+	std::vector<Subtree> subtrees;
+
+	Node *build(size_t lo, size_t hi, int thread_num)
+	{
+		if (lo == hi) {
+			return NULL;
+		}
+
+		size_t mid = lo + (hi - lo) / 2;
+		Node *node = Ops::make(keys[mid], thread_num);
+
+		Ops::link(node, build(lo, mid, thread_num), build(mid + 1, hi, thread_num));
+		return node;
+	}
+
+	static void *build_subtree(void *arg)
+	{
+		Subtree *s = (Subtree *)arg;
+
+		s->root = s->loader->build(s->lo, s->hi, s->thread_num);
+		return NULL;
+	}
+
+	/*
+	 * Same shape as build(), but levels above depth only split the range
+	 * and queue the halves as subtrees for the threads
+	 */
+	void split(size_t lo, size_t hi, int depth)
+	{
+		if (depth == 0 || lo == hi) {
+			Subtree s = {this, lo, hi, (int)subtrees.size(), NULL};
+			subtrees.push_back(s);
+			return;
+		}
+
+		size_t mid = lo + (hi - lo) / 2;
+		split(lo, mid, depth - 1);
+		split(mid + 1, hi, depth - 1);
+	}
+
+	Node *link_top(size_t lo, size_t hi, int depth, size_t &next_subtree)
+	{
+		if (depth == 0 || lo == hi) {
+			return subtrees[next_subtree++].root;
+		}
+
+		size_t mid = lo + (hi - lo) / 2;
+		Node *node = Ops::make(keys[mid], 0);
+		Node *left = link_top(lo, mid, depth - 1, next_subtree);
+		Node *right = link_top(mid + 1, hi, depth - 1, next_subtree);
+
+		Ops::link(node, left, right);
+		return node;
+	}
+
+	public:
+	Bulk_Loader(const std::vector<int> &sorted_keys) : keys(sorted_keys) {}
+
+	/*
+	 * Build the tree with up to num_threads threads, numbered 0 to
+	 * num_threads - 1 for Ops::make()
+	 */
+	Node *run(int num_threads)
+	{
+		int depth = 0;
+		size_t next_subtree = 0;
+		std::vector<pthread_t> threads;
+
+		while ((1 << (depth + 1)) <= num_threads) {
+			depth++;
+		}
+
+		subtrees.clear();
+		split(0, keys.size(), depth);
+		threads.resize(subtrees.size());
+
+		for (size_t i = 0; i < subtrees.size(); i++) {
+			if (pthread_create(&threads[i], NULL, build_subtree, &subtrees[i]) != 0) {
+				// Build it ourselves
+				threads[i] = pthread_self();
+				build_subtree(&subtrees[i]);
+			}
+		}
+		for (size_t i = 0; i < subtrees.size(); i++) {
+			if (!pthread_equal(threads[i], pthread_self())) {
+				pthread_join(threads[i], NULL);
+			}
+		}
+
+		return link_top(0, keys.size(), depth, next_subtree);
+	}
+};
+
+/*
+ * Sort keys and drop duplicates, as the trees don't allow them
+ */
+static inline void bulk_load_prepare(std::vector<int> &keys)
+{
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+#endif
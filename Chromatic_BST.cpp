@@ -0,0 +1,754 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "Chromatic_BST.h"
+#include "threads.h"
+#include "Epoch_Reclaim.h"
+#include "Slab_Alloc.h"
+
+/*
+ * Lock-free chromatic tree, after Brown, Ellen and Ruppert, "A General
+ * Technique for Non-blocking Trees" (PPoPP 2014).
+ *
+ * Every update reads the nodes it depends on with LLX(), builds a small
+ * replacement subtree out of new nodes, and installs it with a single
+ * SCX(), which freezes the nodes it read, marks the ones it removes and
+ * swings one child pointer. Updates never lock; a thread that runs into a
+ * frozen node helps the SCX that froze it.
+ *
+ * Balance is relaxed: an insert may leave a red-red violation behind and a
+ * delete an overweight one. The thread that created a violation calls
+ * cleanup(), which walks down the same search path and applies the
+ * chromatic rebalancing steps (BLK, RB1, RB2, PUSH and rotations) until no
+ * violation is left on it. A few rare configurations have no step here;
+ * those violations are left in place, which costs some balance but never
+ * correctness.
+ */
+extern bool epoch_reclamation;
+
+CT_Thread_Ctx ct_thread_ctx[MAX_THREADS];
+
+/*
+ * entry never changes. Its left child is the root of the tree, initially a
+ * leaf holding CT_INF1; its right child is a leaf holding CT_INF2. Every
+ * key in the tree is in entry's left subtree.
+ */
+static CT_Node *entry;
+
+/*
+ * Initial info of every node. It is aborted, so it freezes nothing, and it
+ * is never freed.
+ */
+static SCX_Record dummy_scx;
+
+/*
+ * An update in the making: the nodes it depends on, with their LLX()
+ * snapshots, and the new nodes that replace some of them
+ */
+typedef struct Chromatic_BST_Update {
+	CT_Node *nodes[CT_MAX_SCX_NODES];
+	CT_Snapshot snaps[CT_MAX_SCX_NODES];
+	int num_nodes;
+	unsigned removed_mask;
+	CT_Node *fresh[CT_MAX_SCX_NODES];
+	int num_fresh;
+} CT_Update;
+
+static bool help_scx(SCX_Record *scx, CT_Thread_Ctx *ctx);
+
+static CT_Node *new_node(int key, int weight, CT_Node *left, CT_Node *right, CT_Thread_Ctx *ctx)
+{
+	CT_Node *node = (CT_Node *)slab_alloc(ctx->thread_num, sizeof(CT_Node));
+
+	// Relaxed: a node is published by the CAS that completes its SCX
+	node->key = key;
+	node->weight = weight;
+	node->left.store(left, std::memory_order_relaxed);
+	node->right.store(right, std::memory_order_relaxed);
+	node->info.store(&dummy_scx, std::memory_order_relaxed);
+	node->marked.store(false, std::memory_order_relaxed);
+	return node;
+}
+
+// Leaves never get children, so this never changes
+static inline bool is_leaf(CT_Node *node)
+{
+	return (node->left.load(std::memory_order_relaxed) == NULL);
+}
+
+static inline bool is_child(CT_Snapshot *snap, CT_Node *child)
+{
+	return (snap->left == child || snap->right == child);
+}
+
+static SCX_Record *alloc_scx(CT_Thread_Ctx *ctx)
+{
+	SCX_Record *scx;
+
+	if (ctx->scx_pool.empty()) {
+		scx = new SCX_Record;
+	} else {
+		scx = ctx->scx_pool.back();
+		ctx->scx_pool.pop_back();
+	}
+	return scx;
+}
+
+/*
+ * Take a reference on scx before trying to point a node's info at it.
+ * Fails once every reference is gone, which means the SCX is long over.
+ * Like the lock-free tree's operations, records are only counted (and
+ * freed) with epoch reclamation.
+ */
+static bool retain_scx(SCX_Record *scx)
+{
+	int refs;
+
+	if (!epoch_reclamation || scx == &dummy_scx) {
+		return true;
+	}
+
+	refs = scx->refs.load(std::memory_order_relaxed);
+	while (refs > 0) {
+		if (scx->refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void release_scx(SCX_Record *scx, CT_Thread_Ctx *ctx)
+{
+	if (!epoch_reclamation || scx == &dummy_scx) {
+		return;
+	}
+
+	if (scx->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		epoch_retire(ctx->thread_num, scx, reclaim_scx);
+	}
+}
+
+/**
+ * llx:
+ *
+ * Take a snapshot of node's children. Fails if node is frozen for an SCX
+ * that is still running (which we help along) or that removed it.
+ */
+static bool llx(CT_Node *node, CT_Snapshot *snap, CT_Thread_Ctx *ctx)
+{
+	SCX_Record *info = node->info.load(std::memory_order_acquire);
+	int state = info->state.load(std::memory_order_acquire);
+	bool marked = node->marked.load(std::memory_order_acquire);
+
+	if (state == SCX_ABORTED || (state == SCX_COMMITTED && !marked)) {
+		snap->left = node->left.load(std::memory_order_acquire);
+		snap->right = node->right.load(std::memory_order_acquire);
+		if (node->info.load(std::memory_order_acquire) == info) {
+			snap->info = info;
+			return true;
+		}
+	}
+
+	if (info->state.load(std::memory_order_acquire) == SCX_IN_PROGRESS) {
+		help_scx(info, ctx);
+	}
+	return false;
+}
+
+/**
+ * help_scx:
+ *
+ * Run scx to completion. Returns true if it committed.
+ * The orderings are acquire/release throughout: a helper that finds a
+ * node frozen for some other record has to see all_frozen set if scx got
+ * that far, which the chain all_frozen -> state -> another LLX -> the
+ * freezing CAS guarantees.
+ */
+static bool help_scx(SCX_Record *scx, CT_Thread_Ctx *ctx)
+{
+	CT_Node *old_child;
+
+	// Freeze every node, in order
+	for (int i = 0; i < scx->num_nodes; i++) {
+		CT_Node *node = scx->nodes[i];
+		SCX_Record *seen = scx->info_fields[i];
+
+		if (node->info.load(std::memory_order_acquire) == scx) {
+			continue;
+		}
+
+		if (!retain_scx(scx)) {
+			// Even the creator has let go, so the outcome is settled
+			return (scx->state.load(std::memory_order_acquire) == SCX_COMMITTED);
+		}
+
+		if (node->info.compare_exchange_strong(seen, scx, std::memory_order_acq_rel,
+						       std::memory_order_acquire)) {
+			// node no longer points at the record of its previous update
+			release_scx(scx->info_fields[i], ctx);
+			continue;
+		}
+		release_scx(scx, ctx);
+
+		if (seen != scx) {
+			/*
+			 * Somebody changed node since the LLX. Unless we were all
+			 * frozen already (and node has moved on since we committed),
+			 * the SCX fails.
+			 */
+			if (scx->all_frozen.load(std::memory_order_acquire)) {
+				return true;
+			}
+			scx->state.store(SCX_ABORTED, std::memory_order_release);
+			return false;
+		}
+	}
+
+	scx->all_frozen.store(true, std::memory_order_release);
+	for (int i = 0; i < scx->num_nodes; i++) {
+		if (scx->removed_mask & (1u << i)) {
+			scx->nodes[i]->marked.store(true, std::memory_order_release);
+		}
+	}
+
+	// Release publishes the new subtree
+	old_child = scx->old_child;
+	scx->field->compare_exchange_strong(old_child, scx->new_child, std::memory_order_acq_rel,
+					    std::memory_order_relaxed);
+	scx->state.store(SCX_COMMITTED, std::memory_order_release);
+	return true;
+}
+
+static void update_init(CT_Update *u)
+{
+	u->num_nodes = 0;
+	u->removed_mask = 0;
+	u->num_fresh = 0;
+}
+
+/*
+ * LLX node as the next node the update depends on. removed says whether
+ * the update replaces it.
+ */
+static CT_Snapshot *update_llx(CT_Update *u, CT_Node *node, bool removed, CT_Thread_Ctx *ctx)
+{
+	CT_Snapshot *snap = &u->snaps[u->num_nodes];
+
+	if (!llx(node, snap, ctx)) {
+		return NULL;
+	}
+
+	u->nodes[u->num_nodes] = node;
+	if (removed) {
+		u->removed_mask |= 1u << u->num_nodes;
+	}
+	u->num_nodes++;
+	return snap;
+}
+
+static CT_Node *update_new_node(CT_Update *u, int key, int weight, CT_Node *left, CT_Node *right,
+				CT_Thread_Ctx *ctx)
+{
+	CT_Node *node = new_node(key, weight, left, right, ctx);
+
+	u->fresh[u->num_fresh++] = node;
+	return node;
+}
+
+/**
+ * update_commit:
+ *
+ * SCX the update: replace old_child, a child of the first node the update
+ * LLXed, with new_child. On success the removed nodes are retired; on
+ * failure the new nodes were never seen by anyone and are freed.
+ */
+static bool update_commit(CT_Update *u, CT_Node *old_child, CT_Node *new_child, CT_Thread_Ctx *ctx)
+{
+	SCX_Record *scx = alloc_scx(ctx);
+	CT_Node *parent = u->nodes[0];
+	bool committed;
+
+	scx->refs.store(1, std::memory_order_relaxed);
+	scx->state.store(SCX_IN_PROGRESS, std::memory_order_relaxed);
+	scx->all_frozen.store(false, std::memory_order_relaxed);
+	scx->num_nodes = u->num_nodes;
+	scx->removed_mask = u->removed_mask;
+	for (int i = 0; i < u->num_nodes; i++) {
+		scx->nodes[i] = u->nodes[i];
+		scx->info_fields[i] = u->snaps[i].info;
+	}
+	scx->field = (u->snaps[0].left == old_child) ? &parent->left : &parent->right;
+	scx->old_child = old_child;
+	scx->new_child = new_child;
+
+	ctx->stats.scx_attempts++;
+	committed = help_scx(scx, ctx);
+
+	if (committed) {
+		for (int i = 0; i < u->num_nodes; i++) {
+			if ((u->removed_mask & (1u << i)) && epoch_reclamation) {
+				epoch_retire(ctx->thread_num, u->nodes[i], reclaim_CT_node);
+			}
+		}
+	} else {
+		ctx->stats.scx_failures++;
+		for (int i = 0; i < u->num_fresh; i++) {
+			slab_free(u->fresh[i], ctx->thread_num);
+		}
+	}
+
+	// The creator's reference
+	release_scx(scx, ctx);
+	return committed;
+}
+
+/*
+ * Find the leaf key belongs in, along with its parent and grandparent
+ */
+static void search(int key, CT_Node *&gp, CT_Node *&p, CT_Node *&l)
+{
+	gp = NULL;
+	p = entry;
+	l = entry->left.load(std::memory_order_acquire);
+
+	while (!is_leaf(l)) {
+		gp = p;
+		p = l;
+		l = (key < l->key) ? l->left.load(std::memory_order_acquire) :
+				     l->right.load(std::memory_order_acquire);
+	}
+}
+
+/**
+ * fix_red_red:
+ *
+ * l and its parent p are both red. BLK if p's sibling is red too,
+ * otherwise a single (RB1) or double (RB2) rotation at gp.
+ */
+static int fix_red_red(CT_Node *ggp, CT_Node *gp, CT_Node *p, CT_Node *l, CT_Thread_Ctx *ctx)
+{
+	CT_Update u;
+	CT_Snapshot *sggp, *sgp, *sp, *ss, *sl;
+	CT_Node *s, *top, *p_new, *s_new, *gp_new;
+	bool left_side;
+
+	// The root is never red, so a red p has a grandparent
+	if (ggp == NULL) {
+		return REBALANCE_SKIPPED;
+	}
+
+	update_init(&u);
+	if ((sggp = update_llx(&u, ggp, false, ctx)) == NULL || !is_child(sggp, gp)) {
+		return REBALANCE_FAILED;
+	}
+	if ((sgp = update_llx(&u, gp, true, ctx)) == NULL || !is_child(sgp, p)) {
+		return REBALANCE_FAILED;
+	}
+	left_side = (sgp->left == p);
+	s = left_side ? sgp->right : sgp->left;
+
+	if (s->weight == 0) {
+		// BLK: gp takes a unit of weight from both its children
+		CT_Node *first = left_side ? p : s;
+		CT_Node *second = left_side ? s : p;
+		CT_Snapshot *sfirst, *ssecond;
+
+		// A red gp is a violation above this one, left over from a skip
+		if (gp->weight == 0) {
+			return REBALANCE_SKIPPED;
+		}
+		if ((sfirst = update_llx(&u, first, true, ctx)) == NULL ||
+		    (ssecond = update_llx(&u, second, true, ctx)) == NULL) {
+			return REBALANCE_FAILED;
+		}
+		sp = left_side ? sfirst : ssecond;
+		ss = left_side ? ssecond : sfirst;
+		if (!is_child(sp, l)) {
+			return REBALANCE_FAILED;
+		}
+
+		p_new = update_new_node(&u, p->key, 1, sp->left, sp->right, ctx);
+		s_new = update_new_node(&u, s->key, 1, ss->left, ss->right, ctx);
+		top = update_new_node(&u, gp->key, (ggp == entry) ? 1 : gp->weight - 1,
+				      left_side ? p_new : s_new, left_side ? s_new : p_new, ctx);
+	} else {
+		if ((sp = update_llx(&u, p, true, ctx)) == NULL || !is_child(sp, l)) {
+			return REBALANCE_FAILED;
+		}
+
+		if (left_side && sp->left == l) {
+			// RB1: rotate right at gp
+			gp_new = update_new_node(&u, gp->key, 0, sp->right, s, ctx);
+			top = update_new_node(&u, p->key, gp->weight, l, gp_new, ctx);
+		} else if (!left_side && sp->right == l) {
+			// RB1, mirrored
+			gp_new = update_new_node(&u, gp->key, 0, s, sp->left, ctx);
+			top = update_new_node(&u, p->key, gp->weight, gp_new, l, ctx);
+		} else {
+			// RB2: l is the inner grandchild, rotate it up to the top
+			if (is_leaf(l)) {
+				return REBALANCE_SKIPPED;
+			}
+			if ((sl = update_llx(&u, l, true, ctx)) == NULL) {
+				return REBALANCE_FAILED;
+			}
+
+			if (left_side) {
+				p_new = update_new_node(&u, p->key, 0, sp->left, sl->left, ctx);
+				gp_new = update_new_node(&u, gp->key, 0, sl->right, s, ctx);
+				top = update_new_node(&u, l->key, gp->weight, p_new, gp_new, ctx);
+			} else {
+				gp_new = update_new_node(&u, gp->key, 0, s, sl->left, ctx);
+				p_new = update_new_node(&u, p->key, 0, sl->right, sp->right, ctx);
+				top = update_new_node(&u, l->key, gp->weight, gp_new, p_new, ctx);
+			}
+		}
+	}
+
+	return update_commit(&u, gp, top, ctx) ? REBALANCE_DONE : REBALANCE_FAILED;
+}
+
+/**
+ * fix_overweight:
+ *
+ * l's weight is more than 1. With a red sibling, rotate so that l gets a
+ * black one. With a black sibling, PUSH a unit of weight from l and its
+ * sibling up into p, or, when the sibling is exactly black and has a red
+ * child, fix l with a single or double rotation.
+ */
+static int fix_overweight(CT_Node *gp, CT_Node *p, CT_Node *l, CT_Thread_Ctx *ctx)
+{
+	CT_Update u;
+	CT_Snapshot *sgp, *sp, *sl, *ss, *sx;
+	CT_Node *s, *near, *far, *top, *p_new, *l_new, *s_new, *far_new;
+	bool left_side;
+
+	update_init(&u);
+	if ((sgp = update_llx(&u, gp, false, ctx)) == NULL || !is_child(sgp, p)) {
+		return REBALANCE_FAILED;
+	}
+	if ((sp = update_llx(&u, p, true, ctx)) == NULL || !is_child(sp, l)) {
+		return REBALANCE_FAILED;
+	}
+	left_side = (sp->left == l);
+	s = left_side ? sp->right : sp->left;
+
+	if (s->weight == 0) {
+		/*
+		 * Red sibling: rotate it up. p comes down as a red node over l
+		 * and s's near child, which must therefore be black, as must p.
+		 */
+		if (p->weight == 0 || is_leaf(s)) {
+			return REBALANCE_SKIPPED;
+		}
+		if ((ss = update_llx(&u, s, true, ctx)) == NULL) {
+			return REBALANCE_FAILED;
+		}
+		near = left_side ? ss->left : ss->right;
+		far = left_side ? ss->right : ss->left;
+		if (near->weight == 0) {
+			return REBALANCE_SKIPPED;
+		}
+
+		if (left_side) {
+			p_new = update_new_node(&u, p->key, 0, l, near, ctx);
+			top = update_new_node(&u, s->key, p->weight, p_new, far, ctx);
+		} else {
+			p_new = update_new_node(&u, p->key, 0, near, l, ctx);
+			top = update_new_node(&u, s->key, p->weight, far, p_new, ctx);
+		}
+		return update_commit(&u, p, top, ctx) ? REBALANCE_DONE : REBALANCE_FAILED;
+	}
+
+	// Black sibling. LLX l and s left to right.
+	if (left_side) {
+		sl = update_llx(&u, l, true, ctx);
+		ss = (sl != NULL) ? update_llx(&u, s, true, ctx) : NULL;
+	} else {
+		ss = update_llx(&u, s, true, ctx);
+		sl = (ss != NULL) ? update_llx(&u, l, true, ctx) : NULL;
+	}
+	if (sl == NULL || ss == NULL) {
+		return REBALANCE_FAILED;
+	}
+	near = left_side ? ss->left : ss->right;
+	far = left_side ? ss->right : ss->left;
+	l_new = update_new_node(&u, l->key, l->weight - 1, sl->left, sl->right, ctx);
+
+	if (is_leaf(s) || s->weight > 1 || (near->weight > 0 && far->weight > 0)) {
+		// PUSH: the new s can only turn red if it has no red child
+		s_new = update_new_node(&u, s->key, s->weight - 1, ss->left, ss->right, ctx);
+		top = update_new_node(&u, p->key, p->weight + 1, left_side ? l_new : s_new,
+				      left_side ? s_new : l_new, ctx);
+	} else if (far->weight == 0) {
+		// Single rotation at p, the red far child turns black
+		if ((sx = update_llx(&u, far, true, ctx)) == NULL) {
+			goto failed;
+		}
+		far_new = update_new_node(&u, far->key, 1, sx->left, sx->right, ctx);
+		if (left_side) {
+			p_new = update_new_node(&u, p->key, 1, l_new, near, ctx);
+			top = update_new_node(&u, s->key, p->weight, p_new, far_new, ctx);
+		} else {
+			p_new = update_new_node(&u, p->key, 1, near, l_new, ctx);
+			top = update_new_node(&u, s->key, p->weight, far_new, p_new, ctx);
+		}
+	} else {
+		// Double rotation, the red near child goes to the top
+		if (is_leaf(near)) {
+			for (int i = 0; i < u.num_fresh; i++) {
+				slab_free(u.fresh[i], ctx->thread_num);
+			}
+			return REBALANCE_SKIPPED;
+		}
+		if ((sx = update_llx(&u, near, true, ctx)) == NULL) {
+			goto failed;
+		}
+		if (left_side) {
+			p_new = update_new_node(&u, p->key, 1, l_new, sx->left, ctx);
+			s_new = update_new_node(&u, s->key, 1, sx->right, far, ctx);
+			top = update_new_node(&u, near->key, p->weight, p_new, s_new, ctx);
+		} else {
+			s_new = update_new_node(&u, s->key, 1, far, sx->left, ctx);
+			p_new = update_new_node(&u, p->key, 1, sx->right, l_new, ctx);
+			top = update_new_node(&u, near->key, p->weight, s_new, p_new, ctx);
+		}
+	}
+
+	return update_commit(&u, p, top, ctx) ? REBALANCE_DONE : REBALANCE_FAILED;
+
+failed:
+	for (int i = 0; i < u.num_fresh; i++) {
+		slab_free(u.fresh[i], ctx->thread_num);
+	}
+	return REBALANCE_FAILED;
+}
+
+/**
+ * cleanup:
+ *
+ * Called by an update that left a violation on key's search path. Walk
+ * down the path and fix the first violation on it, over and over, until
+ * the walk reaches a leaf without finding one. Violations we have no step
+ * for are walked past.
+ */
+static void cleanup(int key, CT_Thread_Ctx *ctx)
+{
+	CT_Node *ggp, *gp, *p, *l;
+	int result;
+
+restart:
+	ggp = NULL;
+	gp = NULL;
+	p = entry;
+	l = entry->left.load(std::memory_order_acquire);
+
+	while (true) {
+		// The root's weight doesn't matter, and entry is never red
+		if ((l->weight > 1 && p != entry) || (l->weight == 0 && p->weight == 0)) {
+			if (l->weight > 1) {
+				result = fix_overweight(gp, p, l, ctx);
+			} else {
+				result = fix_red_red(ggp, gp, p, l, ctx);
+			}
+
+			if (result == REBALANCE_DONE) {
+				ctx->stats.rebalances++;
+				goto restart;
+			} else if (result == REBALANCE_FAILED) {
+				goto restart;
+			}
+			ctx->stats.rebalances_skipped++;
+		}
+
+		if (is_leaf(l)) {
+			return;
+		}
+
+		ggp = gp;
+		gp = p;
+		p = l;
+		l = (key < l->key) ? l->left.load(std::memory_order_acquire) :
+				     l->right.load(std::memory_order_acquire);
+	}
+}
+
+bool chromatic_contains(int key, CT_Thread_Ctx *ctx)
+{
+	CT_Node *gp, *p, *l;
+
+	search(key, gp, p, l);
+	return (l->key == key);
+}
+
+/**
+ * chromatic_insert:
+ *
+ * Replace the leaf l key belongs in with a new internal node whose
+ * children are a new leaf for key and a copy of l. The new internal node
+ * takes one unit of weight from l, so it may come out red under a red
+ * parent.
+ */
+bool chromatic_insert(int key, CT_Thread_Ctx *ctx)
+{
+	CT_Update u;
+	CT_Snapshot *sp;
+	CT_Node *gp, *p, *l, *leaf, *sibling, *internal;
+	int weight;
+
+	while (true) {
+		search(key, gp, p, l);
+		if (l->key == key) {
+			return false;
+		}
+
+		update_init(&u);
+		if ((sp = update_llx(&u, p, false, ctx)) == NULL || !is_child(sp, l)) {
+			continue;
+		}
+		if (update_llx(&u, l, true, ctx) == NULL) {
+			continue;
+		}
+
+		weight = (p == entry) ? 1 : std::max(l->weight - 1, 0);
+		leaf = update_new_node(&u, key, 1, NULL, NULL, ctx);
+		sibling = update_new_node(&u, l->key, 1, NULL, NULL, ctx);
+		if (key < l->key) {
+			internal = update_new_node(&u, l->key, weight, leaf, sibling, ctx);
+		} else {
+			internal = update_new_node(&u, key, weight, sibling, leaf, ctx);
+		}
+
+		if (update_commit(&u, l, internal, ctx)) {
+			if (weight == 0 && p->weight == 0) {
+				cleanup(key, ctx);
+			}
+			return true;
+		}
+	}
+}
+
+/**
+ * chromatic_remove:
+ *
+ * Replace l's parent p with a copy of l's sibling s, which takes on the
+ * weight of p as well as its own and may come out overweight.
+ */
+bool chromatic_remove(int key, CT_Thread_Ctx *ctx)
+{
+	CT_Update u;
+	CT_Snapshot *sgp, *sp, *ss, *sfirst, *ssecond;
+	CT_Node *gp, *p, *l, *s, *copy;
+	int weight;
+
+	while (true) {
+		search(key, gp, p, l);
+		if (l->key != key || gp == NULL) {
+			return false;
+		}
+
+		update_init(&u);
+		if ((sgp = update_llx(&u, gp, false, ctx)) == NULL || !is_child(sgp, p)) {
+			continue;
+		}
+		if ((sp = update_llx(&u, p, true, ctx)) == NULL || !is_child(sp, l)) {
+			continue;
+		}
+		s = (sp->left == l) ? sp->right : sp->left;
+
+		// l and s, left to right
+		sfirst = update_llx(&u, sp->left, true, ctx);
+		ssecond = (sfirst != NULL) ? update_llx(&u, sp->right, true, ctx) : NULL;
+		if (sfirst == NULL || ssecond == NULL) {
+			continue;
+		}
+		ss = (sp->left == s) ? sfirst : ssecond;
+
+		weight = (gp == entry) ? 1 : p->weight + s->weight;
+		copy = update_new_node(&u, s->key, weight, ss->left, ss->right, ctx);
+
+		if (update_commit(&u, p, copy, ctx)) {
+			if (weight > 1) {
+				cleanup(key, ctx);
+			}
+			return true;
+		}
+	}
+}
+
+void chromatic_init(void)
+{
+	CT_Thread_Ctx *ctx = get_CT_thread_ctx(0);
+
+	dummy_scx.state.store(SCX_ABORTED, std::memory_order_relaxed);
+	dummy_scx.refs.store(1, std::memory_order_relaxed);
+	entry = new_node(CT_INF2, 1, new_node(CT_INF1, 1, NULL, NULL, ctx),
+			 new_node(CT_INF2, 1, NULL, NULL, ctx), ctx);
+}
+
+CT_Node *get_chromatic_root(void)
+{
+	return entry->left.load(std::memory_order_acquire);
+}
+
+/*
+ * Called by the epoch reclamation code once nobody can reach the node
+ */
+void reclaim_CT_node(void *ptr, int thread_num)
+{
+	CT_Node *node = (CT_Node *)ptr;
+	CT_Thread_Ctx *ctx = &ct_thread_ctx[thread_num];
+
+	// The SCX that removed the node loses the node's reference
+	release_scx(node->info.load(std::memory_order_relaxed), ctx);
+	slab_free(node, thread_num);
+}
+
+void reclaim_scx(void *ptr, int thread_num)
+{
+	ct_thread_ctx[thread_num].scx_pool.push_back((SCX_Record *)ptr);
+}
+
+CT_Thread_Ctx *get_CT_thread_ctx(int thread_num)
+{
+	CT_Thread_Ctx *ctx = &ct_thread_ctx[thread_num];
+
+	ctx->thread_num = thread_num;
+	return ctx;
+}
+
+/*
+ * Only for use once the worker threads are gone
+ */
+static void tree_depth(CT_Node *node, int depth, int &min_depth, int &max_depth)
+{
+	if (is_leaf(node)) {
+		min_depth = std::min(min_depth, depth);
+		max_depth = std::max(max_depth, depth);
+		return;
+	}
+	tree_depth(node->left.load(std::memory_order_relaxed), depth + 1, min_depth, max_depth);
+	tree_depth(node->right.load(std::memory_order_relaxed), depth + 1, min_depth, max_depth);
+}
+
+void print_CT_stats(void)
+{
+	CT_Stats total = {0, 0, 0, 0};
+	int min_depth = INT_MAX, max_depth = 0;
+
+	for (int i = 0; i < MAX_THREADS; i++) {
+		total.scx_attempts += ct_thread_ctx[i].stats.scx_attempts;
+		total.scx_failures += ct_thread_ctx[i].stats.scx_failures;
+		total.rebalances += ct_thread_ctx[i].stats.rebalances;
+		total.rebalances_skipped += ct_thread_ctx[i].stats.rebalances_skipped;
+	}
+	tree_depth(get_chromatic_root(), 1, min_depth, max_depth);
+
+	printf("Chromatic tree: SCX attempts %lu, SCX failures %lu, rebalancing steps %lu, "
+	       "violations skipped %lu\n", total.scx_attempts, total.scx_failures,
+	       total.rebalances, total.rebalances_skipped);
+	printf("Chromatic tree: leaf depth min %d, max %d\n", min_depth, max_depth);
+}
@@ -0,0 +1,113 @@
+#ifndef _CHROMATIC_BST_H_
+#define _CHROMATIC_BST_H_
+
+#include <limits.h>
+#include <atomic>
+#include <vector>
+
+#include "threads.h"
+#include "Epoch_Reclaim.h"
+
+/*
+ * Keys of the sentinels. They are larger than any key the tree can hold.
+ */
+#define CT_INF1				(INT_MAX - 1)
+#define CT_INF2				INT_MAX
+
+/*
+ * Largest number of nodes a single update (SCX) depends on
+ */
+#define CT_MAX_SCX_NODES		5
+
+enum scx_state {
+	SCX_IN_PROGRESS = 0,
+	SCX_COMMITTED,
+	SCX_ABORTED
+};
+
+enum rebalance_result {
+	REBALANCE_DONE = 0,
+	REBALANCE_FAILED,	// lost a race, look for the violation again
+	REBALANCE_SKIPPED	// a case we don't fix, leave the violation alone
+};
+
+struct SCX_Record;
+
+/*
+ * Leaf-oriented tree: keys live in the leaves, internal nodes only route
+ * (key < node->key goes left). The weight of a node is its colour
+ * generalised: 0 is red, 1 is black, more is overweight.
+ * key and weight never change; a node that needs a different weight is
+ * replaced by a copy.
+ */
+typedef struct Chromatic_BST_Node {
+	int key;
+	int weight;
+	std::atomic<struct Chromatic_BST_Node *> left;	// NULL for leaves
+	std::atomic<struct Chromatic_BST_Node *> right;
+	std::atomic<struct SCX_Record *> info;
+	std::atomic<bool> marked;
+} CT_Node;
+
+/*
+ * A multi-node update, as in Brown, Ellen and Ruppert's LLX/SCX.
+ * The nodes in nodes[] are frozen by pointing their info at the record,
+ * the ones in removed_mask are marked, and then field is swung from
+ * old_child to new_child. Any thread that finds a frozen node helps.
+ *
+ * refs counts the info fields pointing to the record plus one for its
+ * creator while the SCX runs. Once it drops to zero the record is retired
+ * (only with epoch reclamation).
+ */
+typedef struct SCX_Record {
+	std::atomic<int> refs;
+	std::atomic<int> state;
+	std::atomic<bool> all_frozen;
+	int num_nodes;
+	unsigned removed_mask;
+	CT_Node *nodes[CT_MAX_SCX_NODES];
+	struct SCX_Record *info_fields[CT_MAX_SCX_NODES];
+	std::atomic<CT_Node *> *field;
+	CT_Node *old_child;
+	CT_Node *new_child;
+} SCX_Record;
+
+/*
+ * What LLX() returns: the node's info and children as of one instant
+ */
+typedef struct Chromatic_BST_Snapshot {
+	SCX_Record *info;
+	CT_Node *left;
+	CT_Node *right;
+} CT_Snapshot;
+
+typedef struct Chromatic_BST_Stats {
+	unsigned long scx_attempts;
+	unsigned long scx_failures;
+	unsigned long rebalances;
+	unsigned long rebalances_skipped;
+} CT_Stats;
+
+/*
+ * Per-thread state of the chromatic tree, cache line aligned like
+ * LF_Thread_Ctx
+ */
+struct alignas(CACHE_LINE_SIZE) CT_Thread_Ctx {
+	int thread_num;
+	std::vector<SCX_Record *> scx_pool;
+	CT_Stats stats;
+};
+
+//Main BST functions
+void chromatic_init(void);
+bool chromatic_insert(int key, CT_Thread_Ctx *ctx);
+bool chromatic_remove(int key, CT_Thread_Ctx *ctx);
+bool chromatic_contains(int key, CT_Thread_Ctx *ctx);
+
+//other functions
+CT_Thread_Ctx *get_CT_thread_ctx(int thread_num);
+CT_Node *get_chromatic_root(void);
+void print_CT_stats(void);
+void reclaim_CT_node(void *ptr, int thread_num);
+void reclaim_scx(void *ptr, int thread_num);
+#endif
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+
+#include "Epoch_Reclaim.h"
+#include "threads.h"
+
+/*
+ * Epoch based reclamation.
+ *
+ * Every operation on the tree runs between epoch_enter() and epoch_exit().
+ * A node unlinked from the tree is not freed right away; it is put on the
+ * retiring thread's limbo list for the current global epoch. The global epoch
+ * can only move from e to e + 1 once every thread inside an operation has
+ * announced e. Objects retired in epoch e are therefore unreachable by
+ * everybody once the global epoch reaches e + 2.
+ *
+ * Readers only pay for one fence per operation (in epoch_enter()) instead of
+ * one per hop like the hazard pointer scheme.
+ */
+std::atomic<unsigned long> global_epoch(0);
+Epoch_Thread epoch_threads[MAX_THREADS];
+
+static void limbo_push(Epoch_Thread *self, const Retired &r)
+{
+	size_t size = self->limbo.size();
+
+	if (self->limbo_count == size) {
+		std::vector<Retired> grown(size == 0 ? EPOCH_BATCH : 2 * size);
+
+		for (size_t i = 0; i < self->limbo_count; i++) {
+			grown[i] = self->limbo[(self->limbo_head + i) % size];
+		}
+		self->limbo.swap(grown);
+		self->limbo_head = 0;
+		size = self->limbo.size();
+	}
+
+	self->limbo[(self->limbo_head + self->limbo_count) % size] = r;
+	self->limbo_count++;
+}
+
+/*
+ * Free every object in limbo that was retired at least two epochs before
+ * max_epoch.
+ * The reclaim functions can retire more objects, which are appended to the
+ * tail of the same ring buffer, so every entry is copied out before it is
+ * reclaimed.
+ */
+static void free_limbo(Epoch_Thread *self, int thread_num, unsigned long max_epoch)
+{
+	self->reclaiming = true;
+
+	while (self->limbo_count > 0) {
+		Retired r = self->limbo[self->limbo_head];
+
+		if (r.epoch + 2 > max_epoch) {
+			break;
+		}
+
+		self->limbo_head = (self->limbo_head + 1) % self->limbo.size();
+		self->limbo_count--;
+		r.reclaim(r.ptr, thread_num);
+		self->freed++;
+	}
+
+	self->reclaiming = false;
+}
+
+/*
+ * Try to move the global epoch forward. This fails if some thread is still
+ * inside an operation it started in an older epoch.
+ */
+static bool try_advance(unsigned long curr_epoch)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	for (int i = 0; i < num_threads; i++) {
+		unsigned long announce = epoch_threads[i].announce.load(std::memory_order_acquire);
+
+		if ((announce & 1) && (announce >> 1) != curr_epoch) {
+			return false;
+		}
+	}
+
+	return global_epoch.compare_exchange_strong(curr_epoch, curr_epoch + 1,
+						    std::memory_order_acq_rel);
+}
+
+void epoch_enter(int thread_num)
+{
+	Epoch_Thread *self = &epoch_threads[thread_num];
+	unsigned long curr_epoch = global_epoch.load(std::memory_order_acquire);
+
+	self->announce.store((curr_epoch << 1) | 1, std::memory_order_relaxed);
+
+	/*
+	 * The announcement has to be visible before we read any pointer out of
+	 * the tree. This is the only fence on the read path.
+	 */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void epoch_exit(int thread_num)
+{
+	Epoch_Thread *self = &epoch_threads[thread_num];
+
+	self->announce.store(self->announce.load(std::memory_order_relaxed) & ~1UL,
+			     std::memory_order_release);
+}
+
+/**
+ * epoch_retire:
+ *
+ * Must be called by the thread whose CAS unlinked ptr.
+ * The object is tagged with the global epoch read after the unlink, so that
+ * anyone who could still see it announced an epoch no newer than that.
+ */
+void epoch_retire(int thread_num, void *ptr, reclaim_fn reclaim)
+{
+	Epoch_Thread *self = &epoch_threads[thread_num];
+	unsigned long curr_epoch = global_epoch.load(std::memory_order_acquire);
+	Retired r;
+
+	r.ptr = ptr;
+	r.reclaim = reclaim;
+	r.epoch = curr_epoch;
+	limbo_push(self, r);
+	self->retired++;
+
+	/*
+	 * Batch the expensive part. Scanning all the announcements on every
+	 * retire would cost more than the frees themselves.
+	 * Objects retired from inside a reclaim function wait for the next batch.
+	 */
+	if (++self->retired_since_advance >= EPOCH_BATCH && !self->reclaiming) {
+		self->retired_since_advance = 0;
+		try_advance(curr_epoch);
+		free_limbo(self, thread_num, global_epoch.load(std::memory_order_acquire));
+	}
+}
+
+/**
+ * epoch_drain:
+ *
+ * Free everything this thread still has in limbo. Only safe once no other
+ * thread is inside an operation, e.g. after all the workers are joined.
+ */
+void epoch_drain(int thread_num)
+{
+	free_limbo(&epoch_threads[thread_num], thread_num, ~0UL);
+}
+
+/*
+ * Objects retired and not yet freed, over all threads. Only exact while no
+ * thread is inside an operation.
+ */
+unsigned long epoch_pending()
+{
+	unsigned long pending = 0;
+
+	for (int i = 0; i < MAX_THREADS; i++) {
+		pending += epoch_threads[i].retired - epoch_threads[i].freed;
+	}
+	return pending;
+}
+
+void epoch_print_stats()
+{
+	unsigned long retired = 0, freed = 0;
+
+	for (int i = 0; i < MAX_THREADS; i++) {
+		retired += epoch_threads[i].retired;
+		freed += epoch_threads[i].freed;
+	}
+
+	printf("Epoch reclamation: global epoch %lu, retired %lu, freed %lu\n",
+	       global_epoch.load(), retired, freed);
+}
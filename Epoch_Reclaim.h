@@ -0,0 +1,49 @@
+#ifndef _EPOCH_RECLAIM_H_
+#define _EPOCH_RECLAIM_H_
+
+#include <atomic>
+#include <vector>
+
+#include "threads.h"
+
+#define EPOCH_BATCH			64
+
+/*
+ * Called once an object has survived a grace period. thread_num is the
+ * thread doing the free, which is always the thread that retired it.
+ * A reclaim function may itself retire other objects.
+ */
+typedef void (*reclaim_fn)(void *ptr, int thread_num);
+
+typedef struct Retired_Object {
+	void *ptr;
+	reclaim_fn reclaim;
+	unsigned long epoch;
+} Retired;
+
+/*
+ * Per-thread epoch state.
+ * announce is read by every thread trying to advance the epoch, so it gets
+ * a cache line to itself. The limbo list is only ever touched by the
+ * owning thread. It is a ring buffer ordered by retire epoch, so the
+ * objects that are safe to free are always at its head.
+ */
+struct alignas(CACHE_LINE_SIZE) Epoch_Thread {
+	std::atomic<unsigned long> announce;	// (epoch << 1) | active
+	alignas(CACHE_LINE_SIZE) std::vector<Retired> limbo;
+	size_t limbo_head;
+	size_t limbo_count;
+	bool reclaiming;
+	unsigned long retired_since_advance;
+	unsigned long retired;
+	unsigned long freed;
+};
+
+void epoch_enter(int thread_num);
+void epoch_exit(int thread_num);
+void epoch_retire(int thread_num, void *ptr, reclaim_fn reclaim);
+void epoch_drain(int thread_num);
+unsigned long epoch_pending();
+void epoch_print_stats();
+
+#endif
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+
+#include "External_BST.h"
+#include "Bulk_Load.h"
+#include "threads.h"
+#include "Epoch_Reclaim.h"
+#include "Slab_Alloc.h"
+
+/*
+ * Lock-free external BST, after Natarajan and Mittal, "Fast Concurrent
+ * Lock-Free Binary Search Trees" (PPoPP 2014).
+ *
+ * An insert replaces a leaf with a new internal node over the leaf and a
+ * new leaf, in one CAS on the parent's edge. A delete flags the edge to
+ * its leaf (injection), tags the edge to the leaf's sibling, and swings
+ * the edge above the parent to the sibling (cleanup). Flagged and tagged
+ * edges never change again, so each step is a single CAS on one edge and
+ * a delete touches no more than the leaf, its parent and its sibling.
+ * Anyone who runs into a flagged or tagged edge finishes the cleanup.
+ *
+ * If deletes pile up on one path, one cleanup may remove a whole chain of
+ * nodes whose edges were tagged: everything from the successor down to
+ * the parent in the seek record.
+ */
+extern bool epoch_reclamation;
+
+EXT_Thread_Ctx ext_thread_ctx[MAX_THREADS];
+
+/*
+ * R and S never change. R's left child is S, its right child a leaf
+ * holding EXT_INF2. S's left subtree is the tree, whose largest leaf holds
+ * EXT_INF0; S's right child is a leaf holding EXT_INF1.
+ */
+static EXT_Node *R;
+static EXT_Node *S;
+
+static EXT_Node *new_node(int key, EXT_Node *left, EXT_Node *right, EXT_Thread_Ctx *ctx)
+{
+	EXT_Node *node = (EXT_Node *)slab_alloc(ctx->thread_num, sizeof(EXT_Node));
+
+	// Relaxed: a node is published by the CAS that links it
+	node->key = key;
+	node->left.store(left, std::memory_order_relaxed);
+	node->right.store(right, std::memory_order_relaxed);
+	return node;
+}
+
+static inline Tagged_Atomic_Ptr<EXT_Node> *child_edge(EXT_Node *node, int key)
+{
+	return (key < node->key) ? &node->left : &node->right;
+}
+
+/**
+ * seek:
+ *
+ * Find the leaf key belongs in, its parent, and the last untagged edge
+ * (ancestor -> successor) above them.
+ */
+static void seek(int key, EXT_Seek_Record *s)
+{
+	EXT_Node *parent_field, *current_field, *current;
+
+	parent_field = S->left.load(std::memory_order_acquire);
+	s->ancestor = R;
+	s->successor = S;
+	s->parent = S;
+	s->leaf = UNFLAG(parent_field);
+
+	current_field = child_edge(s->leaf, key)->load(std::memory_order_acquire);
+	while ((current = UNFLAG(current_field)) != NULL) {
+		if (!(GET_FLAG(parent_field) & EXT_TAG)) {
+			s->ancestor = s->parent;
+			s->successor = s->leaf;
+		}
+
+		s->parent = s->leaf;
+		s->leaf = current;
+		parent_field = current_field;
+		current_field = child_edge(current, key)->load(std::memory_order_acquire);
+	}
+}
+
+/*
+ * Retire what a successful cleanup cut off: every node from successor
+ * down to parent, and the flagged leaf hanging off each of them. Their
+ * edges are all flagged or tagged, so nobody changes them under us.
+ */
+static void retire_chain(EXT_Node *successor, EXT_Node *parent, EXT_Node *kept,
+			 EXT_Thread_Ctx *ctx)
+{
+	EXT_Node *node = successor, *left, *right;
+
+	if (!epoch_reclamation) {
+		return;
+	}
+
+	while (true) {
+		left = node->left.load(std::memory_order_relaxed);
+		right = node->right.load(std::memory_order_relaxed);
+		epoch_retire(ctx->thread_num, node, reclaim_EXT_node);
+
+		if (node == parent) {
+			epoch_retire(ctx->thread_num, (UNFLAG(left) == kept) ? UNFLAG(right) : UNFLAG(left),
+				     reclaim_EXT_node);
+			return;
+		}
+
+		// Above parent, the chain goes on through the edge without the flag
+		if (GET_FLAG(left) & EXT_FLAG) {
+			epoch_retire(ctx->thread_num, UNFLAG(left), reclaim_EXT_node);
+			node = UNFLAG(right);
+		} else {
+			epoch_retire(ctx->thread_num, UNFLAG(right), reclaim_EXT_node);
+			node = UNFLAG(left);
+		}
+	}
+}
+
+/**
+ * cleanup:
+ *
+ * Finish the delete of whichever child of s->parent has a flagged edge:
+ * tag the edge to the other child, then hang that child where successor
+ * was. The flag of the surviving edge moves up with it, so a delete
+ * pending on it is not lost.
+ */
+static bool cleanup(int key, EXT_Seek_Record *s, EXT_Thread_Ctx *ctx)
+{
+	Tagged_Atomic_Ptr<EXT_Node> *successor_edge, *leaf_edge, *sibling_edge;
+	EXT_Node *sibling;
+
+	successor_edge = child_edge(s->ancestor, key);
+	leaf_edge = child_edge(s->parent, key);
+	sibling_edge = (leaf_edge == &s->parent->left) ? &s->parent->right : &s->parent->left;
+
+	if (!(leaf_edge->flag(std::memory_order_acquire) & EXT_FLAG)) {
+		// It's the sibling that is being deleted, our side stays
+		sibling_edge = leaf_edge;
+	}
+
+	sibling = sibling_edge->fetch_flag(EXT_TAG, std::memory_order_acq_rel);
+
+	if (!successor_edge->cas(s->successor, SET_FLAG(UNFLAG(sibling), GET_FLAG(sibling) & EXT_FLAG),
+				 std::memory_order_acq_rel, std::memory_order_relaxed)) {
+		return false;
+	}
+
+	ctx->stats.cleanups++;
+	retire_chain(s->successor, s->parent, UNFLAG(sibling), ctx);
+	return true;
+}
+
+bool external_contains(int key, EXT_Thread_Ctx *ctx)
+{
+	EXT_Node *node = S, *child;
+
+	while ((child = UNFLAG(child_edge(node, key)->load(std::memory_order_acquire))) != NULL) {
+		node = child;
+	}
+	return (node->key == key);
+}
+
+/**
+ * external_insert:
+ *
+ * Replace the leaf key belongs in with a new internal node over that leaf
+ * and a new one for key. The edge to the leaf must be clean; if a delete
+ * has flagged or tagged it, help the delete along and try again.
+ */
+bool external_insert(int key, EXT_Thread_Ctx *ctx)
+{
+	EXT_Seek_Record *s = &ctx->seek;
+	Tagged_Atomic_Ptr<EXT_Node> *edge;
+	EXT_Node *leaf, *new_leaf = NULL, *internal = NULL, *seen;
+
+	while (true) {
+		seek(key, s);
+		leaf = s->leaf;
+		if (leaf->key == key) {
+			break;
+		}
+
+		// The new nodes are private until the CAS, so they are reused across attempts
+		if (new_leaf == NULL) {
+			new_leaf = new_node(key, NULL, NULL, ctx);
+			internal = new_node(key, NULL, NULL, ctx);
+		}
+		if (key < leaf->key) {
+			internal->key = leaf->key;
+			internal->left.store(new_leaf, std::memory_order_relaxed);
+			internal->right.store(leaf, std::memory_order_relaxed);
+		} else {
+			internal->key = key;
+			internal->left.store(leaf, std::memory_order_relaxed);
+			internal->right.store(new_leaf, std::memory_order_relaxed);
+		}
+
+		edge = child_edge(s->parent, key);
+		seen = edge->cas_val(leaf, internal, std::memory_order_release, std::memory_order_acquire);
+		if (seen == leaf) {
+			return true;
+		}
+
+		ctx->stats.insert_retries++;
+		if (UNFLAG(seen) == leaf && GET_FLAG(seen) != 0) {
+			ctx->stats.helps++;
+			cleanup(key, s, ctx);
+		}
+	}
+
+	if (new_leaf != NULL) {
+		slab_free(new_leaf, ctx->thread_num);
+		slab_free(internal, ctx->thread_num);
+	}
+	return false;
+}
+
+/**
+ * external_remove:
+ *
+ * Flag the edge to key's leaf, which makes the delete take effect, then
+ * clean up until the leaf is out of the tree, by us or by a helper.
+ */
+bool external_remove(int key, EXT_Thread_Ctx *ctx)
+{
+	EXT_Seek_Record *s = &ctx->seek;
+	Tagged_Atomic_Ptr<EXT_Node> *edge;
+	EXT_Node *leaf = NULL, *seen;
+	bool injecting = true;
+
+	while (true) {
+		seek(key, s);
+
+		if (injecting) {
+			leaf = s->leaf;
+			if (leaf->key != key) {
+				return false;
+			}
+
+			edge = child_edge(s->parent, key);
+			seen = edge->cas_val(leaf, SET_FLAG(leaf, EXT_FLAG), std::memory_order_acq_rel,
+					     std::memory_order_acquire);
+			if (seen == leaf) {
+				injecting = false;
+				if (cleanup(key, s, ctx)) {
+					return true;
+				}
+			} else if (UNFLAG(seen) == leaf && GET_FLAG(seen) != 0) {
+				ctx->stats.helps++;
+				cleanup(key, s, ctx);
+			}
+		} else {
+			if (s->leaf != leaf) {
+				// Somebody else's cleanup removed it
+				return true;
+			}
+			if (cleanup(key, s, ctx)) {
+				return true;
+			}
+		}
+		ctx->stats.delete_retries++;
+	}
+}
+
+void external_init(void)
+{
+	EXT_Thread_Ctx *ctx = get_EXT_thread_ctx(0);
+
+	S = new_node(EXT_INF1, new_node(EXT_INF0, NULL, NULL, ctx),
+		     new_node(EXT_INF1, NULL, NULL, ctx), ctx);
+	R = new_node(EXT_INF2, S, new_node(EXT_INF2, NULL, NULL, ctx), ctx);
+}
+
+EXT_Node *get_external_root(void)
+{
+	return UNFLAG(S->left.load(std::memory_order_acquire));
+}
+
+/*
+ * Leaf-oriented version of Bulk_Loader::build(): leaves hold keys[lo, hi),
+ * and each internal node routes on the first key of its right half
+ */
+static EXT_Node *bulk_build(const std::vector<int> &keys, size_t lo, size_t hi, EXT_Thread_Ctx *ctx)
+{
+	size_t mid;
+
+	if (hi - lo == 1) {
+		return new_node(keys[lo], NULL, NULL, ctx);
+	}
+
+	mid = lo + (hi - lo) / 2;
+	return new_node(keys[mid], bulk_build(keys, lo, mid, ctx), bulk_build(keys, mid, hi, ctx), ctx);
+}
+
+/**
+ * bulk_load_external:
+ *
+ * Build a balanced tree out of keys and hang it under S with a single
+ * store. keys ends up sorted and without duplicates. The tree must be
+ * empty and nobody else may be using it yet.
+ */
+void bulk_load_external(std::vector<int> &keys)
+{
+	EXT_Thread_Ctx *ctx = get_EXT_thread_ctx(0);
+	EXT_Node *old_root = get_external_root();
+
+	bulk_load_prepare(keys);
+	if (keys.empty()) {
+		return;
+	}
+
+	// The tree keeps its EXT_INF0 leaf, as its largest key
+	keys.push_back(EXT_INF0);
+	S->left.store(bulk_build(keys, 0, keys.size(), ctx), std::memory_order_release);
+	keys.pop_back();
+	slab_free(old_root, ctx->thread_num);
+}
+
+/*
+ * Called by the epoch reclamation code once nobody can reach the node
+ */
+void reclaim_EXT_node(void *ptr, int thread_num)
+{
+	slab_free(ptr, thread_num);
+}
+
+EXT_Thread_Ctx *get_EXT_thread_ctx(int thread_num)
+{
+	EXT_Thread_Ctx *ctx = &ext_thread_ctx[thread_num];
+
+	ctx->thread_num = thread_num;
+	return ctx;
+}
+
+void print_EXT_stats(void)
+{
+	EXT_Stats total = {0, 0, 0, 0};
+
+	for (int i = 0; i < MAX_THREADS; i++) {
+		total.insert_retries += ext_thread_ctx[i].stats.insert_retries;
+		total.delete_retries += ext_thread_ctx[i].stats.delete_retries;
+		total.cleanups += ext_thread_ctx[i].stats.cleanups;
+		total.helps += ext_thread_ctx[i].stats.helps;
+	}
+
+	printf("External tree: insert retries %lu, delete retries %lu, cleanups %lu, helps %lu\n",
+	       total.insert_retries, total.delete_retries, total.cleanups, total.helps);
+}
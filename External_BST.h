@@ -0,0 +1,79 @@
+#ifndef _EXTERNAL_BST_H_
+#define _EXTERNAL_BST_H_
+
+#include <limits.h>
+#include <atomic>
+#include <vector>
+
+#include "threads.h"
+#include "Epoch_Reclaim.h"
+#include "Tagged_Ptr.h"
+
+/*
+ * Keys of the sentinels. They are larger than any key the tree can hold.
+ */
+#define EXT_INF0			(INT_MAX - 2)
+#define EXT_INF1			(INT_MAX - 1)
+#define EXT_INF2			INT_MAX
+
+/*
+ * Bits of a child edge. A flagged edge leads to a leaf that is being
+ * deleted, a tagged edge to a node whose parent is being removed. Neither
+ * kind of edge is ever changed again.
+ */
+#define EXT_TAG				ONE
+#define EXT_FLAG			TWO
+
+/*
+ * Leaf-oriented tree, after Natarajan and Mittal: keys live in the leaves,
+ * internal nodes only route (key < node->key goes left). Internal nodes
+ * always have two children, leaves have NULL ones. Nodes never change
+ * apart from the bits on their edges.
+ */
+typedef struct External_BST_Node {
+	int key;
+	Tagged_Atomic_Ptr<struct External_BST_Node> left;
+	Tagged_Atomic_Ptr<struct External_BST_Node> right;
+} EXT_Node;
+
+/*
+ * Where seek() ended up. The edge from ancestor to successor is the last
+ * untagged edge on the path, and the one cleanup() swings.
+ */
+typedef struct External_BST_Seek_Record {
+	EXT_Node *ancestor;
+	EXT_Node *successor;
+	EXT_Node *parent;
+	EXT_Node *leaf;
+} EXT_Seek_Record;
+
+typedef struct External_BST_Stats {
+	unsigned long insert_retries;
+	unsigned long delete_retries;
+	unsigned long cleanups;
+	unsigned long helps;
+} EXT_Stats;
+
+/*
+ * Per-thread state of the external tree, cache line aligned like
+ * LF_Thread_Ctx
+ */
+struct alignas(CACHE_LINE_SIZE) EXT_Thread_Ctx {
+	int thread_num;
+	EXT_Seek_Record seek;
+	EXT_Stats stats;
+};
+
+//Main BST functions
+void external_init(void);
+bool external_insert(int key, EXT_Thread_Ctx *ctx);
+bool external_remove(int key, EXT_Thread_Ctx *ctx);
+bool external_contains(int key, EXT_Thread_Ctx *ctx);
+
+//other functions
+EXT_Thread_Ctx *get_EXT_thread_ctx(int thread_num);
+EXT_Node *get_external_root(void);
+void bulk_load_external(std::vector<int> &keys);
+void print_EXT_stats(void);
+void reclaim_EXT_node(void *ptr, int thread_num);
+#endif
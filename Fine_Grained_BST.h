@@ -1,13 +1,49 @@
 #ifndef _FINE_GRAINED_BST_H_
 #define _FINE_GRAINED_BST_H_
 
-typedef struct Fine_Grained_BST_Node {
+#include <pthread.h>
+#include <limits.h>
+#include <atomic>
+#include <vector>
+
+#include "Node_Lock.h"
+
+/*
+ * Bits of a node's version, for optimistic readers. A writer holding the
+ * node's lock sets FG_WRITING while it changes the node, and bumps the
+ * version by FG_VERSION_STEP when it is done. A node that has been taken
+ * out of the tree gets FG_OBSOLETE for good.
+ */
+#define FG_WRITING			1UL
+#define FG_OBSOLETE			2UL
+#define FG_VERSION_STEP			4UL
+
+/*
+ * Value of the sentinel at the top of the tree. Keys must be larger.
+ */
+#define FG_SENTINEL_VALUE		INT_MIN
+
+/*
+ * The node lock is a template parameter, fixed at compile time by
+ * FG_LOCK_POLICY (set through FG_LOCK in the Makefile), see Node_Lock.h.
+ * The lock sits right after value, where the smaller locks fill what would
+ * otherwise be padding.
+ */
+#ifndef FG_LOCK_POLICY
+#define FG_LOCK_POLICY			Pthread_Lock
+#endif
+
+template <typename Lock>
+struct Fine_Grained_BST_Node_Base {
 	int value;
-	struct Fine_Grained_BST_Node *left;
-	struct Fine_Grained_BST_Node *right;
-	struct Fine_Grained_BST_Node *parent;
-	pthread_mutex_t lock;
-}FG_BST_Node;
+	Lock lock;
+	struct Fine_Grained_BST_Node_Base *left;
+	struct Fine_Grained_BST_Node_Base *right;
+	struct Fine_Grained_BST_Node_Base *parent;
+	std::atomic<unsigned long> version;
+};
+
+typedef struct Fine_Grained_BST_Node_Base<FG_LOCK_POLICY> FG_BST_Node;
 
 void insert(int val, FG_BST_Node* root, FG_BST_Node *parent, int thread_num);
 void search(int val, FG_BST_Node* root, FG_BST_Node *parent);
@@ -16,5 +52,18 @@ FG_BST_Node *get_inorder_successor(FG_BST_Node *root);
 FG_BST_Node *get_inorder_predecessor(FG_BST_Node *root);
 FG_BST_Node* del_search(int val, FG_BST_Node* root, int thread_num);
 int remove(int val, FG_BST_Node* root, int thread_num);
+void bulk_load_FG(std::vector<int> &keys, int num_threads);
+void print_FG_stats(void);
+
+//Optimistic versions: lock-free reads, writers lock only what they change
+bool search_optimistic(int val);
+void insert_optimistic(int val, int thread_num);
+int remove_optimistic(int val, int thread_num);
+void reclaim_FG_node(void *ptr, int thread_num);
+
+//Reader-writer versions: traversals take the node locks shared
+bool search_rw(int val);
+void insert_rw(int val, int thread_num);
+int remove_rw(int val, int thread_num);
 
 #endif
@@ -1,52 +1,141 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <assert.h>
-#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <vector>
 
 #include "Fine_Grained_BST.h"
-#include "cycle_timer.h"
-
-extern pthread_mutex_t tree_lock;
+#include "Bulk_Load.h"
+#include "Epoch_Reclaim.h"
+
+/*
+ * g_root is a sentinel that holds FG_SENTINEL_VALUE and is never removed;
+ * the real tree is its right child. Every node of the real tree has a
+ * parent, so there are no special cases for an empty tree or for the
+ * root, and no tree-wide lock: even an operation on the real root only
+ * locks the sentinel hand-over-hand, like any other parent.
+ */
 extern FG_BST_Node *g_root;
+extern bool optimistic_reads;
+extern bool rw_locks;
+
+/*
+ * Optimistic reads (seqlock-style optimistic lock coupling).
+ *
+ * Every change to a node's value or children happens with the node locked
+ * and between write_begin() and write_end(). A reader takes no locks: it
+ * reads a node's version, reads the node, and checks the version is still
+ * the same before trusting what it read. Going down, it reads the child's
+ * version before re-checking the parent's, so a validated parent proves
+ * the child was still its child. Any change on the way means starting over
+ * from the root.
+ *
+ * That only proves each step down was right when it was taken. A remove
+ * that copies a successor's (or predecessor's) value up into an ancestor
+ * moves a key out of the subtree a reader is already in. The ancestor's
+ * version changes when that happens, so a reader that comes up empty
+ * checks every node on its path again before believing it, and so does
+ * an insert before it links its node.
+ *
+ * Readers hold no reference the writers know about, so with optimistic
+ * reads a node taken out of the tree is marked obsolete and freed through
+ * epoch reclamation instead of right away.
+ */
+static inline void write_begin(FG_BST_Node *node)
+{
+	node->version.store(node->version.load(std::memory_order_relaxed) | FG_WRITING,
+			    std::memory_order_relaxed);
+	// Orders the store above before the writes to the node that follow
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+static inline void write_end(FG_BST_Node *node)
+{
+	node->version.store((node->version.load(std::memory_order_relaxed) & ~FG_WRITING) +
+			    FG_VERSION_STEP, std::memory_order_release);
+}
+
+static inline void mark_obsolete(FG_BST_Node *node)
+{
+	node->version.store(node->version.load(std::memory_order_relaxed) | FG_OBSOLETE,
+			    std::memory_order_release);
+}
+
+/*
+ * Wait for a writer to finish with node. Fails if node is out of the tree.
+ */
+static bool read_version(FG_BST_Node *node, unsigned long *version)
+{
+	unsigned long v;
+
+	while ((v = node->version.load(std::memory_order_acquire)) & FG_WRITING) {
+		sched_yield();
+	}
+
+	*version = v;
+	return !(v & FG_OBSOLETE);
+}
+
+/*
+ * True if nothing about node changed since its version was read
+ */
+static inline bool validate(FG_BST_Node *node, unsigned long version)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return (node->version.load(std::memory_order_relaxed) == version);
+}
+
+/*
+ * Nodes go through epoch reclamation when optimistic readers may still be
+ * looking at them
+ */
+static void free_FG_node(FG_BST_Node *node, int thread_num)
+{
+	if (optimistic_reads) {
+		epoch_retire(thread_num, node, reclaim_FG_node);
+	} else {
+		free(node);
+	}
+}
+
+void reclaim_FG_node(void *ptr, int thread_num)
+{
+	FG_BST_Node *node = (FG_BST_Node *)ptr;
+
+	node->lock.destroy();
+	free(node);
+}
+
+static int remove_locked(FG_BST_Node *to_be_deleted, FG_BST_Node *parent, int thread_num);
 
 void search(int val, FG_BST_Node *root, FG_BST_Node *parent)
 {
-	if(parent == NULL) { //I am at the root
-		pthread_mutex_lock(&tree_lock);
-		if(g_root == NULL) {
-			printf("Search failed for node with value %d\n", val);
-			pthread_mutex_unlock(&tree_lock);
-			return;
-		}
-		pthread_mutex_lock(&g_root->lock);
-		root = g_root;
-		pthread_mutex_unlock(&tree_lock);		
+	if(parent == NULL) { //I am at the sentinel
+		root->lock.lock();
 	}
 
 	if(val < root->value) {
 		if (root->left == NULL) {
-			printf("Search failed for node with value %d\n", val);
-			pthread_mutex_unlock(&root->lock);
+			root->lock.unlock();
 			return;
 		} else {
-			pthread_mutex_lock(&root->left->lock);
-			pthread_mutex_unlock(&root->lock);
+			root->left->lock.lock();
+			root->lock.unlock();
 			search(val, root->left, root);
 		}
 	}
 	else if (val > root->value) {
 		if (root->right == NULL) {
-			printf("Search failed for node with value %d\n", val);
-			pthread_mutex_unlock(&root->lock);
+			root->lock.unlock();
 			return;
 		} else {
-			pthread_mutex_lock(&root->right->lock);
-			pthread_mutex_unlock(&root->lock);
+			root->right->lock.lock();
+			root->lock.unlock();
 			search(val, root->right, root);
 		}
 	} else {
-		pthread_mutex_unlock(&root->lock);
+		root->lock.unlock();
 	}
 }	
 /**
@@ -56,46 +145,45 @@ void search(int val, FG_BST_Node *root, FG_BST_Node *parent)
 
 void insert(int val, FG_BST_Node* root, FG_BST_Node *parent, int thread_num) {
 
-	if(parent == NULL) { //I am at the root
-		pthread_mutex_lock(&tree_lock);
-		if(g_root == NULL) {
-			g_root = createNode(val, parent);
-			pthread_mutex_unlock(&tree_lock);
-			return;
-		}
-		pthread_mutex_lock(&g_root->lock);
-		root = g_root;
-		pthread_mutex_unlock(&tree_lock);		
+	if(parent == NULL) { //I am at the sentinel
+		root->lock.lock();
 	}
 
 	if(val < root->value) {
 		if (root->left == NULL) {
-			root->left = createNode(val, root);
-			pthread_mutex_unlock(&root->lock);
+			FG_BST_Node *node = createNode(val, root);
+
+			write_begin(root);
+			root->left = node;
+			write_end(root);
+			root->lock.unlock();
 		} else {
-			pthread_mutex_lock(&root->left->lock);
-			pthread_mutex_unlock(&root->lock);
+			root->left->lock.lock();
+			root->lock.unlock();
 			insert(val, root->left, root, thread_num);
 		}
 	}
 	else if (val > root->value) {
 		if (root->right == NULL) {
-			root->right = createNode(val, root);
-			pthread_mutex_unlock(&root->lock);
+			FG_BST_Node *node = createNode(val, root);
+
+			write_begin(root);
+			root->right = node;
+			write_end(root);
+			root->lock.unlock();
 		} else {
-			pthread_mutex_lock(&root->right->lock);
-			pthread_mutex_unlock(&root->lock);
+			root->right->lock.lock();
+			root->lock.unlock();
 			insert(val, root->right, root, thread_num);
 		}
 	} else {
-		printf("Duplicates not allowed");
-		assert(0);
+		// Already there, so like the other trees leave it be
+		root->lock.unlock();
 	}
 }
 
 FG_BST_Node* createNode(int val, FG_BST_Node *parent) {
 
-	printf("creating a new node\n");
 	FG_BST_Node* node = (FG_BST_Node *) malloc(sizeof(FG_BST_Node));
 
 	if(node == NULL) {
@@ -107,7 +195,8 @@ FG_BST_Node* createNode(int val, FG_BST_Node *parent) {
 	node->left = NULL;
 	node->right = NULL;
 	node->parent = parent;
-	pthread_mutex_init(&node->lock, NULL);
+	node->lock.init();
+	node->version.store(0, std::memory_order_relaxed);
 
 	return node;
 }
@@ -116,29 +205,23 @@ FG_BST_Node* createNode(int val, FG_BST_Node *parent) {
  * del_search:
  * search for the first node that matches the value val.
  * It is assumed that this function will be called with a lock on root held
+ * and that root doesn't hold val (it starts at the sentinel).
  * If del_search() finds the required node it grabs the lock on the node and 
- * returns.
+ * returns, still holding the lock on its parent.
  * If it doesn't find the node it releases all the locks and returns
  */
 FG_BST_Node* del_search(int val, FG_BST_Node* root, int thread_num)
 {
-	if(val == root->value) {
-		/*
-		 * We will come in here if we want to delete the root node.
-		 * No need to lock the root because it is already locked by
-		 * the caller.
-		 */
-		return root; 
-	} else if (val < root->value) {
+	if (val < root->value) {
 		if (root->left == NULL) {
-			pthread_mutex_unlock(&root->lock);
+			root->lock.unlock();
 			return NULL;
 		} else {
-			pthread_mutex_lock(&root->left->lock);
+			root->left->lock.lock();
 			if (val == root->left->value) {
 				return root->left;
 			} else {
-				pthread_mutex_unlock(&root->lock);
+				root->lock.unlock();
 				return del_search(val, root->left, thread_num);
 			}
 		}
@@ -147,14 +230,14 @@ FG_BST_Node* del_search(int val, FG_BST_Node* root, int thread_num)
 			/*
 			 * Could not find the node, unlock current root and return
 			 */
-			pthread_mutex_unlock(&root->lock);
+			root->lock.unlock();
 			return NULL;
 		} else {
-			pthread_mutex_lock(&root->right->lock);
+			root->right->lock.lock();
 			if (val == root->right->value) {
 				return root->right;
 			} else {
-				pthread_mutex_unlock(&root->lock);
+				root->lock.unlock();
 				return del_search(val, root->right, thread_num);
 			}
 		}
@@ -165,98 +248,74 @@ FG_BST_Node* del_search(int val, FG_BST_Node* root, int thread_num)
 
 int remove(int val, FG_BST_Node *root, int thread_num)
 {
-	FG_BST_Node *to_be_deleted, *parent, *successor_parent, *successor;
-	FG_BST_Node *predecessor, *predecessor_parent;
-
-	pthread_mutex_lock(&tree_lock);
-	if (g_root == NULL) {
-		pthread_mutex_unlock(&tree_lock);
-		return -EINVAL;
-	}
-
-	root = g_root;
-	pthread_mutex_lock(&root->lock);
-	/*
-	 * Check if we are deleting the root and that the root is the only node 
-	 * in the tree
-	 */
-	if (val == root->value && root->left == NULL && root->right == NULL) {
-		/*
-		 * free the root node,
-		 * set the tree's global root as NULL,
-		 * unlock the treelock and return
-		 */
-		free(root);
-		g_root = NULL;
-		pthread_mutex_unlock(&tree_lock);
-		return 0;
-	}
+	FG_BST_Node *to_be_deleted, *parent;
 
+	root->lock.lock();
 	to_be_deleted = del_search(val, root, thread_num);
 	if (to_be_deleted == NULL) {
 		/*
 		 * if del_search() returns NULL we can be sure that it is not
 		 * holding any locks. So we can just return from here.
 		 */
-		printf("Could not find the item (%d) to be deleted\n", val);
-		pthread_mutex_unlock(&tree_lock);
 		return 0;
 	}
 
 	/*
 	 * If we found the node to be deleted we can be sure that we have a lock
-	 * on the node to be deleted and its parent (if parent exists)
+	 * on the node to be deleted and its parent (the sentinel, for the real
+	 * root)
 	 */
 
 	// store the parent
 	parent = to_be_deleted->parent;
+	return remove_locked(to_be_deleted, parent, thread_num);
+}
 
-	/*
-	 * Because we use the data swapping mechanism we need the lock on parent only 
-	 * if the node to be deleted is a leaf node. Because that is the only case 
-	 * where we need to update to_be_deleted's parent's pointer to NULL
-	 */
-	if (to_be_deleted->left == NULL && to_be_deleted->right == NULL &&
-	    parent == NULL) {
-		free(to_be_deleted);
-		g_root = NULL;
-		pthread_mutex_unlock(&tree_lock);
-		return 0;
-	}
+/**
+ * remove_locked:
+ * Take to_be_deleted's value out of the tree. Called with to_be_deleted
+ * and its parent locked.
+ *
+ * Because we use the data swapping mechanism we need the lock on parent only
+ * if the node to be deleted is a leaf node. Because that is the only case
+ * where we need to update to_be_deleted's parent's pointer to NULL
+ */
+static int remove_locked(FG_BST_Node *to_be_deleted, FG_BST_Node *parent, int thread_num)
+{
+	FG_BST_Node *successor_parent, *successor;
+	FG_BST_Node *predecessor, *predecessor_parent;
 
-	pthread_mutex_unlock(&tree_lock);
 	// Leaf node to be deleted
 	if (to_be_deleted->left == NULL && to_be_deleted->right == NULL) {
+		/*
+		 * Unlock to_be_deleted. We can safely unlock here because we hold
+		 * a lock on the parent and nobody else can come and modify
+		 * to_be_deleted; anybody waiting for its lock finds it obsolete.
+		 */
+		mark_obsolete(to_be_deleted);
+		to_be_deleted->lock.unlock();
+
+		write_begin(parent);
 		if (to_be_deleted->value < parent->value) {
 			// node to be deleted is the left child of its parent
-			/*
-			 * Unlock to_be_deleted. We can safely unlock here because we hold 
-			 * a lock on the parent and nobody else can come and modify to_be_deleted
-			 */
-			// free the node
-			free(to_be_deleted);
-			// set parent's left child as NULL
 			parent->left = NULL;
-			// unlock the parent and return
-			pthread_mutex_unlock(&parent->lock);
-			return 0;
 		} else {
 			// node to be deleted is the right child of its parent
-			// Follow the same procedure as above
-			free(to_be_deleted);
 			parent->right = NULL;
-			pthread_mutex_unlock(&parent->lock);
-			return 0;
 		}
+		write_end(parent);
+
+		// free the node, unlock the parent and return
+		free_FG_node(to_be_deleted, thread_num);
+		parent->lock.unlock();
+		return 0;
 	}
 
 	/*
-	 * At this point, we are either deleting the root or an internal node.
-	 * If deleting an internal node, then unlock the parent.
+	 * At this point, we are deleting an internal node. Its value is
+	 * replaced rather than the node unlinked, so unlock the parent.
 	 */
-	if (parent != NULL) {
-		pthread_mutex_unlock(&parent->lock);
-	}
+	parent->lock.unlock();
 
 	/*
 	 * Find inorder successor or inorder predecessor (whichever exists) for the 
@@ -264,7 +323,7 @@ int remove(int val, FG_BST_Node *root, int thread_num)
 	 */
 	if (to_be_deleted->right != NULL) {
 		// perform pre-emptive check
-		pthread_mutex_lock(&to_be_deleted->right->lock);
+		to_be_deleted->right->lock.lock();
 		if (to_be_deleted->right->left == NULL) {
 			/*
 			 * The right node is the successor,
@@ -278,19 +337,23 @@ int remove(int val, FG_BST_Node *root, int thread_num)
 			 */
 			successor = to_be_deleted->right;
 
+			write_begin(to_be_deleted);
 			if (successor->right != NULL) {
-				pthread_mutex_lock(&successor->right->lock);
+				successor->right->lock.lock();
 				to_be_deleted->value = successor->value;
 				to_be_deleted->right = successor->right;
 				successor->right->parent = to_be_deleted;
-				pthread_mutex_unlock(&successor->right->lock);
+				successor->right->lock.unlock();
 			} else {
 				to_be_deleted->value = successor->value;
 				to_be_deleted->right = NULL;
 			}
-			//pthread_mutex_unlock(&successor->lock);
-			free(successor);
-			pthread_mutex_unlock(&to_be_deleted->lock);
+			write_end(to_be_deleted);
+
+			mark_obsolete(successor);
+			successor->lock.unlock();
+			free_FG_node(successor, thread_num);
+			to_be_deleted->lock.unlock();
 			return 0;
 		}
 
@@ -308,21 +371,27 @@ int remove(int val, FG_BST_Node *root, int thread_num)
 		successor = get_inorder_successor(to_be_deleted);
 		successor_parent = successor->parent;
 
+		write_begin(to_be_deleted);
+		write_begin(successor_parent);
 		if (successor->right != NULL) {
-			pthread_mutex_lock(&successor->right->lock);
+			successor->right->lock.lock();
 			// the successor will always be the left child of it's parent
 			successor_parent->left = successor->right;
 			successor->right->parent = successor_parent;
 			to_be_deleted->value = successor->value;
-			pthread_mutex_unlock(&successor->right->lock);
+			successor->right->lock.unlock();
 		} else {
 			to_be_deleted->value = successor->value;
 			successor_parent->left = NULL;
 		}
-
-		free(successor);
-		pthread_mutex_unlock(&successor_parent->lock);
-		pthread_mutex_unlock(&to_be_deleted->lock);
+		write_end(successor_parent);
+		write_end(to_be_deleted);
+
+		mark_obsolete(successor);
+		successor->lock.unlock();
+		free_FG_node(successor, thread_num);
+		successor_parent->lock.unlock();
+		to_be_deleted->lock.unlock();
 		return 0;
 	}
 
@@ -333,7 +402,7 @@ int remove(int val, FG_BST_Node *root, int thread_num)
 	 */
 
 	if (to_be_deleted->left != NULL) {
-		pthread_mutex_lock(&to_be_deleted->left->lock);
+		to_be_deleted->left->lock.lock();
 		// perform pre-emptive check
 		if (to_be_deleted->left->right == NULL) {
 			/*
@@ -347,19 +416,23 @@ int remove(int val, FG_BST_Node *root, int thread_num)
 			 */
 			predecessor = to_be_deleted->left;
 
+			write_begin(to_be_deleted);
 			if (predecessor->left != NULL) {
-				pthread_mutex_lock(&predecessor->left->lock);
+				predecessor->left->lock.lock();
 				to_be_deleted->value = predecessor->value;
 				to_be_deleted->left = predecessor->left;
 				predecessor->left->parent = to_be_deleted;
-				pthread_mutex_unlock(&predecessor->left->lock);
+				predecessor->left->lock.unlock();
 			} else {
 				to_be_deleted->value = predecessor->value;
 				to_be_deleted->left = NULL;
 			}
+			write_end(to_be_deleted);
 
-			free(predecessor);
-			pthread_mutex_unlock(&to_be_deleted->lock);
+			mark_obsolete(predecessor);
+			predecessor->lock.unlock();
+			free_FG_node(predecessor, thread_num);
+			to_be_deleted->lock.unlock();
 			return 0;
 		}
 
@@ -377,20 +450,27 @@ int remove(int val, FG_BST_Node *root, int thread_num)
 		predecessor = get_inorder_predecessor(to_be_deleted);
 		predecessor_parent = predecessor->parent;
 
+		write_begin(to_be_deleted);
+		write_begin(predecessor_parent);
 		if (predecessor->left != NULL) {
-			pthread_mutex_lock(&predecessor->left->lock);
+			predecessor->left->lock.lock();
 			// predecessor will always be the right child of its parent
 			predecessor_parent->right = predecessor->left;
 			predecessor->left->parent = predecessor_parent;
 			to_be_deleted->value = predecessor->value;
-			pthread_mutex_unlock(&predecessor->left->lock);
+			predecessor->left->lock.unlock();
 		} else {
 			to_be_deleted->value = predecessor->value;
 			predecessor_parent->right = NULL;
 		}
-		free(predecessor);
-		pthread_mutex_unlock(&predecessor_parent->lock);
-		pthread_mutex_unlock(&to_be_deleted->lock);
+		write_end(predecessor_parent);
+		write_end(to_be_deleted);
+
+		mark_obsolete(predecessor);
+		predecessor->lock.unlock();
+		free_FG_node(predecessor, thread_num);
+		predecessor_parent->lock.unlock();
+		to_be_deleted->lock.unlock();
 		return 0;
 	}
 
@@ -411,14 +491,14 @@ FG_BST_Node *get_inorder_successor(FG_BST_Node *node)
 	successor = parent->left;
 
 	// lock the successor
-	pthread_mutex_lock(&successor->lock);
+	successor->lock.lock();
 
 	while (successor->left != NULL) {
 		successor = successor->left;
 		// unlock the old parent
-		pthread_mutex_unlock(&parent->lock);
+		parent->lock.unlock();
 		// lock the new successor
-		pthread_mutex_lock(&successor->lock);
+		successor->lock.lock();
 		// update the parent
 		parent = successor->parent;
 	}
@@ -440,17 +520,439 @@ FG_BST_Node *get_inorder_predecessor(FG_BST_Node *node)
 	predecessor = parent->right;
 
 	// lock the predecessor
-	pthread_mutex_lock(&predecessor->lock);
+	predecessor->lock.lock();
 
 	while (predecessor->right != NULL) {
 		predecessor = predecessor->right;
 		// unlock the old parent
-		pthread_mutex_unlock(&parent->lock);
+		parent->lock.unlock();
 		// lock the new predecessor
-		pthread_mutex_lock(&predecessor->lock);
+		predecessor->lock.lock();
 		// update the parent
 		parent = predecessor->parent;
 	}
 
 	return predecessor;
 }
+
+/*
+ * Where an optimistic descent for a value ended: node holds the value
+ * (found) or is the last node on its path. Both versions were validated
+ * after node was read from parent.
+ */
+typedef struct Fine_Grained_BST_Path_Entry {
+	FG_BST_Node *node;
+	unsigned long version;
+} FG_Path_Entry;
+
+/*
+ * The nodes an optimistic descent went through, above parent. Kept per
+ * thread so its storage is reused across operations.
+ */
+static thread_local std::vector<FG_Path_Entry> optimistic_path;
+
+typedef struct Fine_Grained_BST_Position {
+	FG_BST_Node *parent;
+	FG_BST_Node *node;
+	unsigned long parent_version;
+	unsigned long node_version;
+	bool found;
+} FG_Position;
+
+/**
+ * optimistic_find:
+ * Descend from the sentinel without taking any lock. Returns false if a
+ * concurrent write got in the way and the caller has to start over.
+ * node is never the sentinel when found, so parent is never NULL then.
+ */
+static bool optimistic_find(int val, FG_Position *pos)
+{
+	FG_BST_Node *child;
+	unsigned long child_version;
+	int value;
+
+	pos->parent = NULL;
+	pos->found = false;
+	optimistic_path.clear();
+	pos->node = g_root;
+	// The sentinel is never obsolete
+	read_version(pos->node, &pos->node_version);
+
+	while (true) {
+		value = __atomic_load_n(&pos->node->value, __ATOMIC_RELAXED);
+		if (val == value) {
+			pos->found = true;
+			return validate(pos->node, pos->node_version);
+		}
+
+		child = __atomic_load_n((val < value) ? &pos->node->left : &pos->node->right,
+					__ATOMIC_RELAXED);
+		if (child == NULL) {
+			return validate(pos->node, pos->node_version);
+		}
+
+		if (!read_version(child, &child_version) ||
+		    !validate(pos->node, pos->node_version)) {
+			return false;
+		}
+
+		if (pos->parent != NULL) {
+			optimistic_path.push_back({pos->parent, pos->parent_version});
+		}
+		pos->parent = pos->node;
+		pos->parent_version = pos->node_version;
+		pos->node = child;
+		pos->node_version = child_version;
+	}
+}
+
+/*
+ * True if no node on the way down to pos->node changed since it was read,
+ * i.e. the whole path still looks the way it did
+ */
+static bool validate_path(FG_Position *pos)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	for (size_t i = 0; i < optimistic_path.size(); i++) {
+		if (optimistic_path[i].node->version.load(std::memory_order_relaxed) !=
+		    optimistic_path[i].version) {
+			return false;
+		}
+	}
+
+	return (pos->parent == NULL ||
+		pos->parent->version.load(std::memory_order_relaxed) == pos->parent_version);
+}
+
+/*
+ * Lock node and check that it hasn't changed since version was read
+ */
+static bool lock_validated(FG_BST_Node *node, unsigned long version)
+{
+	node->lock.lock();
+	if (node->version.load(std::memory_order_relaxed) != version) {
+		node->lock.unlock();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * search_optimistic:
+ * Like search(), but takes no locks and writes nothing. Must be called
+ * inside an epoch.
+ */
+bool search_optimistic(int val)
+{
+	FG_Position pos;
+
+	while (!optimistic_find(val, &pos) || (!pos.found && !validate_path(&pos)));
+
+	return pos.found;
+}
+
+/**
+ * insert_optimistic:
+ * Find where val goes without locks, then lock just the node that gets the
+ * new child.
+ */
+void insert_optimistic(int val, int thread_num)
+{
+	FG_Position pos;
+	FG_BST_Node *node;
+
+	while (true) {
+		if (!optimistic_find(val, &pos)) {
+			continue;
+		}
+
+		if (pos.found) {
+			return;
+		}
+
+		if (!lock_validated(pos.node, pos.node_version)) {
+			continue;
+		}
+
+		/*
+		 * With pos.node locked, nothing can move a key past it any
+		 * more, so a path that is still valid stays right
+		 */
+		if (!validate_path(&pos)) {
+			pos.node->lock.unlock();
+			continue;
+		}
+
+		node = createNode(val, pos.node);
+		write_begin(pos.node);
+		if (val < pos.node->value) {
+			pos.node->left = node;
+		} else {
+			pos.node->right = node;
+		}
+		write_end(pos.node);
+		pos.node->lock.unlock();
+		return;
+	}
+}
+
+/**
+ * remove_optimistic:
+ * Find val without locks, then lock the node holding it and its parent,
+ * top down like everybody else, and remove it the same way remove() does.
+ */
+int remove_optimistic(int val, int thread_num)
+{
+	FG_Position pos;
+
+	while (true) {
+		if (!optimistic_find(val, &pos)) {
+			continue;
+		}
+
+		if (!pos.found) {
+			if (!validate_path(&pos)) {
+				continue;
+			}
+			return 0;
+		}
+
+		if (!lock_validated(pos.parent, pos.parent_version)) {
+			continue;
+		}
+
+		if (!lock_validated(pos.node, pos.node_version)) {
+			pos.parent->lock.unlock();
+			continue;
+		}
+
+		return remove_locked(pos.node, pos.parent, thread_num);
+	}
+}
+
+/*
+ * Reader-writer mode.
+ *
+ * Traversals take the node locks shared, hand-over-hand, so operations
+ * passing through the upper levels don't block each other. Only a node
+ * that is about to change is locked exclusively: its shared lock is traded
+ * for an exclusive one while its parent is still held, which keeps it in
+ * the tree in between, and its version tells whether somebody else changed
+ * it first. If so, the operation starts over from the sentinel.
+ */
+
+/*
+ * Trade the shared lock on node for an exclusive one. The caller holds
+ * node's parent, or node is the sentinel. Fails, with node unlocked, if
+ * node changed in between.
+ */
+static bool upgrade(FG_BST_Node *node)
+{
+	unsigned long version = node->version.load(std::memory_order_relaxed);
+
+	node->lock.unlock_shared();
+	return lock_validated(node, version);
+}
+
+/**
+ * search_rw:
+ * Like search(), with shared locks.
+ */
+bool search_rw(int val)
+{
+	FG_BST_Node *node = g_root, *child;
+
+	node->lock.lock_shared();
+	while (val != node->value) {
+		child = (val < node->value) ? node->left : node->right;
+		if (child == NULL) {
+			node->lock.unlock_shared();
+			return false;
+		}
+
+		child->lock.lock_shared();
+		node->lock.unlock_shared();
+		node = child;
+	}
+
+	node->lock.unlock_shared();
+	return true;
+}
+
+/**
+ * insert_rw:
+ * Find where val goes with shared locks, then upgrade just the node that
+ * gets the new child.
+ */
+void insert_rw(int val, int thread_num)
+{
+	FG_BST_Node *parent, *node, *child, **slot;
+	bool upgraded;
+
+	while (true) {
+		parent = NULL;
+		node = g_root;
+		node->lock.lock_shared();
+
+		while (true) {
+			if (val == node->value) {
+				if (parent != NULL) {
+					parent->lock.unlock_shared();
+				}
+				node->lock.unlock_shared();
+				return;
+			}
+
+			slot = (val < node->value) ? &node->left : &node->right;
+			if (*slot == NULL) {
+				break;
+			}
+
+			child = *slot;
+			child->lock.lock_shared();
+			if (parent != NULL) {
+				parent->lock.unlock_shared();
+			}
+			parent = node;
+			node = child;
+		}
+
+		upgraded = upgrade(node);
+		if (parent != NULL) {
+			parent->lock.unlock_shared();
+		}
+		if (!upgraded) {
+			continue;
+		}
+
+		// Same version, so the slot is still empty
+		child = createNode(val, node);
+		write_begin(node);
+		*slot = child;
+		write_end(node);
+		node->lock.unlock();
+		return;
+	}
+}
+
+/**
+ * remove_rw:
+ * Find val with shared locks, then upgrade the parent of the node holding
+ * it, lock that node exclusively, and remove it the same way remove() does.
+ */
+int remove_rw(int val, int thread_num)
+{
+	FG_BST_Node *grandparent, *parent, *node;
+	unsigned long node_version;
+	bool upgraded;
+
+	while (true) {
+		grandparent = NULL;
+		parent = g_root;
+		parent->lock.lock_shared();
+
+		while (true) {
+			node = (val < parent->value) ? parent->left : parent->right;
+			if (node == NULL) {
+				if (grandparent != NULL) {
+					grandparent->lock.unlock_shared();
+				}
+				parent->lock.unlock_shared();
+				return 0;
+			}
+
+			node->lock.lock_shared();
+			if (node->value == val) {
+				break;
+			}
+
+			if (grandparent != NULL) {
+				grandparent->lock.unlock_shared();
+			}
+			grandparent = parent;
+			parent = node;
+		}
+
+		/*
+		 * node stays in the tree while parent is held in either mode,
+		 * and its version catches anything done to it while unlocked
+		 */
+		node_version = node->version.load(std::memory_order_relaxed);
+		node->lock.unlock_shared();
+
+		upgraded = upgrade(parent);
+		if (grandparent != NULL) {
+			grandparent->lock.unlock_shared();
+		}
+		if (!upgraded) {
+			continue;
+		}
+
+		if (!lock_validated(node, node_version)) {
+			parent->lock.unlock();
+			continue;
+		}
+
+		return remove_locked(node, parent, thread_num);
+	}
+}
+
+struct FG_Bulk_Ops {
+	static FG_BST_Node *make(int key, int thread_num)
+	{
+		FG_BST_Node *node = (FG_BST_Node *) malloc(sizeof(FG_BST_Node));
+
+		if (node == NULL) {
+			fprintf(stderr, "Failed to allocate memory for new node");
+			abort();
+		}
+
+		node->value = key;
+		node->left = NULL;
+		node->right = NULL;
+		node->parent = NULL;
+		node->lock.init();
+		node->version.store(0, std::memory_order_relaxed);
+		return node;
+	}
+
+	static void link(FG_BST_Node *parent, FG_BST_Node *left, FG_BST_Node *right)
+	{
+		parent->left = left;
+		parent->right = right;
+		if (left != NULL) {
+			left->parent = parent;
+		}
+		if (right != NULL) {
+			right->parent = parent;
+		}
+	}
+};
+
+/**
+ * bulk_load_FG:
+ * Build a balanced tree out of keys, using num_threads threads, and hang it
+ * under the sentinel. keys ends up sorted and without duplicates. The tree
+ * must be empty and nobody else may be using it yet.
+ */
+void bulk_load_FG(std::vector<int> &keys, int num_threads)
+{
+	Bulk_Loader<FG_BST_Node, FG_Bulk_Ops> loader(keys);
+	FG_BST_Node *root;
+
+	bulk_load_prepare(keys);
+	root = loader.run(num_threads);
+
+	if (root != NULL) {
+		root->parent = g_root;
+		g_root->right = root;
+	}
+}
+
+void print_FG_stats(void)
+{
+	const char *mode = optimistic_reads ? "optimistic" : (rw_locks ? "reader-writer" : "exclusive");
+
+	printf("Fine-grained tree: %s node locks, %s traversal, %zu bytes per node\n",
+	       FG_LOCK_POLICY::name(), mode, sizeof(FG_BST_Node));
+}
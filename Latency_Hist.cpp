@@ -0,0 +1,63 @@
+#include <string.h>
+#include <math.h>
+
+#include "Latency_Hist.h"
+
+/*
+ * Largest value that lands in bucket index
+ */
+static uint64_t bucket_max(int index)
+{
+	int range = index >> LAT_SUB_BITS;
+	int sub = index & (LAT_SUB_BUCKETS - 1);
+
+	if (range == 0) {
+		return index;
+	}
+	return ((uint64_t)(LAT_SUB_BUCKETS + sub + 1) << (range - 1)) - 1;
+}
+
+void latency_hist_reset(Latency_Hist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+}
+
+void latency_hist_merge(Latency_Hist *dst, const Latency_Hist *src)
+{
+	for (int i = 0; i < LAT_BUCKETS; i++) {
+		dst->counts[i] += src->counts[i];
+	}
+
+	dst->count += src->count;
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+}
+
+/**
+ * latency_hist_percentile:
+ *
+ * The value at or below which percentile percent of the recorded values
+ * fall, rounded up to the end of its bucket but never past max
+ */
+uint64_t latency_hist_percentile(const Latency_Hist *hist, double percentile)
+{
+	uint64_t target, seen = 0;
+
+	if (hist->count == 0) {
+		return 0;
+	}
+
+	target = (uint64_t)ceil(percentile / 100.0 * hist->count);
+	if (target == 0) {
+		target = 1;
+	}
+
+	for (int i = 0; i < LAT_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= target) {
+			return (bucket_max(i) < hist->max) ? bucket_max(i) : hist->max;
+		}
+	}
+	return hist->max;
+}
@@ -0,0 +1,58 @@
+#ifndef _LATENCY_HIST_H_
+#define _LATENCY_HIST_H_
+
+#include <stdint.h>
+
+#include "threads.h"
+
+/*
+ * Log-linear latency histogram, in the style of HdrHistogram: values below
+ * LAT_SUB_BUCKETS get a bucket each, and every power of two above that is
+ * split into LAT_SUB_BUCKETS equal buckets, so any recorded value is known
+ * to within 1 / LAT_SUB_BUCKETS (under 1%). Values are in timer ticks and
+ * clamp at 2^LAT_MAX_BITS ticks; max is kept exactly.
+ *
+ * Each thread records into its own histograms without atomics, and they
+ * are merged once the threads are done.
+ */
+#define LAT_SUB_BITS			7
+#define LAT_SUB_BUCKETS			(1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS			40
+#define LAT_BUCKETS			((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
+struct alignas(CACHE_LINE_SIZE) Latency_Hist {
+	uint64_t count;
+	uint64_t max;
+	uint64_t counts[LAT_BUCKETS];
+};
+
+static inline int latency_hist_index(uint64_t ticks)
+{
+	int msb;
+
+	if (ticks < LAT_SUB_BUCKETS) {
+		return (int)ticks;
+	}
+	if (ticks >> LAT_MAX_BITS) {
+		ticks = (1ULL << LAT_MAX_BITS) - 1;
+	}
+
+	msb = 63 - __builtin_clzll(ticks);
+	return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+	       (int)((ticks >> (msb - LAT_SUB_BITS)) - LAT_SUB_BUCKETS);
+}
+
+static inline void latency_hist_record(Latency_Hist *hist, uint64_t ticks)
+{
+	hist->counts[latency_hist_index(ticks)]++;
+	hist->count++;
+	if (ticks > hist->max) {
+		hist->max = ticks;
+	}
+}
+
+void latency_hist_reset(Latency_Hist *hist);
+void latency_hist_merge(Latency_Hist *dst, const Latency_Hist *src);
+uint64_t latency_hist_percentile(const Latency_Hist *hist, double percentile);
+
+#endif
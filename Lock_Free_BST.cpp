@@ -11,10 +11,16 @@
 
 #include "Lock_Free_BST.h"
 #include "threads.h"
+#include "Epoch_Reclaim.h"
+#include "Slab_Alloc.h"
+#include "Bulk_Load.h"
 
-std::array<std::atomic<LF_BST_Node *>, MAX_THREADS * NUM_HP_PER_THREAD> hp;
-std::vector<LF_BST_Node *> rlist[MAX_THREADS];
-int hp_off[MAX_THREADS];
+/*
+ * All the per-thread state of the lock-free tree. Each context starts on
+ * its own cache line (see LF_Thread_Ctx), so threads never write to a line
+ * another thread's hot path is using.
+ */
+LF_Thread_Ctx lf_thread_ctx[MAX_THREADS];
 
 /*
  * The base_root is also called the auxRoot in find().
@@ -24,45 +30,25 @@ int hp_off[MAX_THREADS];
  */
 extern LF_BST_Node *base_root;
 extern bool hazard_pointers;
+extern bool epoch_reclamation;
 
-void *SET_FLAG(void *ptr, int state)
-{
-	ptr = (void *) ((uintptr_t)ptr | (uintptr_t)state);
-	return ptr;
-}
-
-int GET_FLAG(void *ptr)
-{
-	int flag = ((uintptr_t) ptr & (uintptr_t)THREE);
-	return flag;
-}
-
-void *UNFLAG(void *ptr)
-{
-	ptr = (void *)((uintptr_t)ptr & ~(uintptr_t)THREE);
-	return ptr;
-}
-
-void *SET_NULL(void *ptr)
-{
-	ptr = (void *) ((uintptr_t)ptr | (uintptr_t)ONE);
-	return ptr;
-}
-
-bool IS_NULL(void *ptr)
-{
-	int val = ((uintptr_t)ptr & (uintptr_t)ONE);
-	if(val == 1) {
-		return true;
-	}
-	return false;
-}
+/*
+ * Memory ordering.
+ *
+ * Every change to a node goes through a CAS on its op field (or on a child
+ * pointer or key while its op holds the corresponding operation), and the
+ * final CAS of every operation is a release. Reading op with acquire is
+ * therefore enough to see the node's current children and key, and the
+ * contents of the operation descriptor, without full barriers. A stale
+ * read of a child or key is harmless as long as it is validated by a
+ * later CAS on the op it was read under: the op will have changed.
+ */
 
-void add(int key, int thread_num)
+void add(int key, LF_Thread_Ctx *ctx)
 {
-	LF_BST_Node *pred, *curr, *newNode;
+	LF_BST_Node *pred, *curr, *newNode = NULL;
 	void *pred_op, *curr_op;
-	Child_CAS_OP *cas_op;
+	Child_CAS_OP *cas_op = NULL;
 	int result;
 
 	while (true) {
@@ -70,109 +56,207 @@ void add(int key, int thread_num)
 		 * Do a find first. If the value already exists return without doing anything.
 		 * We don't allow duplicates
 		 */
-		result = find(key, pred, pred_op, curr, curr_op, base_root, thread_num);
+		result = find(key, pred, pred_op, curr, curr_op, base_root, ctx);
 		if (hazard_pointers) {
-			add_to_hp_list(thread_num, curr);
+			add_to_hp_list(ctx, curr);
 		}
 
 		if(result == FOUND) {
-			printf("Value %d already exists in the tree\n", key);
+			if (cas_op != NULL) {
+				free_op(cas_op, ctx);
+			}
+			if (newNode != NULL) {
+				free_LF_node(newNode, ctx);
+			}
 			return;
 		}
 
-		// create a new node
-		newNode = create_LF_node(key);
+		/*
+		 * create a new node. Like cas_op, a node from an earlier iteration
+		 * that lost the race was never published and is reused.
+		 */
+		if (newNode == NULL) {
+			newNode = create_LF_node(key, ctx);
+		}
 		if (hazard_pointers) {
-			add_to_hp_list(thread_num, newNode);
+			add_to_hp_list(ctx, newNode);
 		}
 
 		// check if this will be the left node of the node gaining the child
 		bool is_left = (result == NOTFOUND_L);
 		if (hazard_pointers) {
 			if (is_left) {
-				add_to_hp_list(thread_num, curr->left);
+				add_to_hp_list(ctx, curr->left.load(std::memory_order_acquire));
 			} else {
-				add_to_hp_list(thread_num, curr->right);
+				add_to_hp_list(ctx, curr->right.load(std::memory_order_acquire));
 			}
 		}
 
-		LF_BST_Node *old = is_left ? curr->left : curr->right;
+		// Relaxed: the CAS on curr->op below fails if old is out of date
+		LF_BST_Node *old = is_left ? curr->left.load(std::memory_order_relaxed) :
+					     curr->right.load(std::memory_order_relaxed);
 
 		/*
-		 * Create a new Child CAS operation
+		 * Create a new Child CAS operation. If an earlier iteration lost
+		 * the race on curr's op its descriptor was never published, so it
+		 * is simply reused.
 		 */
-		cas_op = new Child_CAS_OP;
+		if (cas_op == NULL) {
+			cas_op = alloc_cas_op(ctx);
+		}
 		cas_op->is_left = is_left;
 		cas_op->expected = old;
 		cas_op->update = newNode;
+		if (hazard_pointers) {
+			announce_op(ctx, cas_op);
+		}
 
 		/*
-		 * Atomically store the newly created Child CAS operation in curr's op
+		 * Atomically store the newly created Child CAS operation in curr's op.
+		 * Release publishes cas_op and newNode to whoever helps it.
 		 */
-		if(__sync_bool_compare_and_swap(&curr->op, curr_op, SET_FLAG((void *) cas_op, CHILDCAS))) {
+		if(curr->op.cas(curr_op, SET_FLAG((void *) cas_op, CHILDCAS),
+				std::memory_order_release, std::memory_order_relaxed)) {
 			/*
 			 *  if CAS on the op succeeded perform the actual operation.
 			 *  In this case helpChildCAS() will replace the left or right 
 			 *  child of curr (old) with the update (newNode)
 			 */
-			helpChildCAS(cas_op, curr, thread_num);
+			release_op(curr_op, ctx);
+			helpChildCAS(cas_op, curr, ctx);
 			return;
-		} else {
-			delete newNode;
-			delete cas_op;
 		}
+		ctx->stats.cas_failures++;
 	}
 }
 
-int find(int key, LF_BST_Node *&pred, void *&pred_op, LF_BST_Node *&curr, void *&curr_op, LF_BST_Node *auxRoot, int thread_num)
+/*
+ * Pop the path until its top entry is a node whose op has not changed since
+ * we passed it, and return the new depth. Returns 0 if no such node is left
+ * in the window, in which case find() starts over from auxRoot.
+ */
+static int find_resume_depth(LF_Path_Entry *path, int depth, int lowest)
 {
-	int result, curr_key;
+	while (depth > lowest && depth > 0) {
+		LF_Path_Entry *e = &path[(depth - 1) % LF_PATH_LEN];
+
+		/*
+		 * Resuming at depth needs the entry above it too, for pred
+		 */
+		if (depth >= 2 && depth - 2 < lowest) {
+			return 0;
+		}
+
+		if (e->node->op.load(std::memory_order_acquire) == e->op) {
+			return depth;
+		}
+		depth--;
+	}
+	return 0;
+}
+
+int find(int key, LF_BST_Node *&pred, void *&pred_op, LF_BST_Node *&curr, void *&curr_op, LF_BST_Node *auxRoot, LF_Thread_Ctx *ctx)
+{
+	int result, curr_key, depth = 0, lowest = 0, last_right_depth;
 	LF_BST_Node *next, *last_right;
 	void *last_right_op;
+	LF_Path_Entry path[LF_PATH_LEN];
+	LF_Path_Entry *e;
 
 retry:
 
-	// Start find from the auxRoot
-	result = NOTFOUND_R;
-	if (hazard_pointers) {
-		add_to_hp_list(thread_num, auxRoot);
-	}
-	curr = auxRoot;
-	curr_op = curr->op;
-
 	/*
-	 * This is a special case where some thread is trying to add to an empty tree
-	 * or remove the logical root. In both these cases, the auxRoot's op won't be
-	 * NONE
+	 * A conflict is usually local to the bottom of the path, so resume from
+	 * the deepest node on it that has not changed instead of auxRoot. A node
+	 * whose op is unchanged still has the same key and children, and is
+	 * still in the tree. Nodes further up the path are not protected by
+	 * hazard pointers anymore, so with --hazard-pointers we always start
+	 * over.
 	 */
-	if(GET_FLAG(curr_op) != NONE) {
-		if(auxRoot == base_root) {
-			// help the ongoing operation at auxRoot and retry find
-			helpChildCAS(((Child_CAS_OP *)UNFLAG(curr_op)), curr, thread_num);
-			goto retry;
+	if (depth > 0 && !hazard_pointers) {
+		depth = find_resume_depth(path, depth, lowest);
+	} else {
+		depth = 0;
+	}
+
+	if (depth > 0) {
+		e = &path[(depth - 1) % LF_PATH_LEN];
+		curr = e->node;
+		curr_op = e->op;
+		last_right = e->last_right;
+		last_right_op = e->last_right_op;
+		last_right_depth = e->last_right_depth;
+		if (depth >= 2) {
+			pred = path[(depth - 2) % LF_PATH_LEN].node;
+			pred_op = path[(depth - 2) % LF_PATH_LEN].op;
 		}
-		else {
-			return ABORT;
+		ctx->stats.local_restarts++;
+		ctx->stats.restart_nodes_saved += depth - 1;
+
+		if (depth == 1) {
+			next = curr->right.load(std::memory_order_acquire);
+			last_right = curr;
+			last_right_op = curr_op;
+			last_right_depth = 0;
+		} else {
+			goto descend;
 		}
-	}
+	} else {
+		// Start find from the auxRoot
+		lowest = 0;
+		if (hazard_pointers) {
+			add_to_hp_list(ctx, auxRoot);
+		}
+		curr = auxRoot;
+		curr_op = curr->op.load(std::memory_order_acquire);
 
-	/*
-	 * next = next node along the search path after curr
-	 * last_right = last node for which the right child path was taken
-	 */
+		/*
+		 * This is a special case where some thread is trying to add to an empty tree
+		 * or remove the logical root. In both these cases, the auxRoot's op won't be
+		 * NONE
+		 */
+		if(GET_FLAG(curr_op) != NONE) {
+			if(auxRoot == base_root) {
+				// help the ongoing operation at auxRoot and retry find
+				if (!hazard_pointers || keep_op(ctx, curr, curr_op)) {
+					helpChildCAS(((Child_CAS_OP *)UNFLAG(curr_op)), curr, ctx);
+				}
+				ctx->stats.find_retries++;
+				goto retry;
+			}
+			else {
+				return ABORT;
+			}
+		}
 
-	if (hazard_pointers) {
-		add_to_hp_list(thread_num, curr->right);
+		/*
+		 * next = next node along the search path after curr
+		 * last_right = last node for which the right child path was taken
+		 *
+		 * Child pointers are read with acquire, which pairs with the release
+		 * CAS in helpChildCAS() that linked the child in, so that its fields
+		 * are initialized when we dereference it.
+		 */
+		next = curr->right.load(std::memory_order_acquire);
+		if (hazard_pointers) {
+			add_to_hp_list(ctx, next);
+		}
+		last_right = curr;
+		last_right_op = curr_op;
+		last_right_depth = 0;
+
+		e = &path[0];
+		e->node = curr;
+		e->op = curr_op;
+		depth = 1;
 	}
-	next = curr->right;
-	last_right = curr;
-	last_right_op = curr_op;
+	result = NOTFOUND_R;
 
 	while(!IS_NULL(next) && next != NULL) {
 		pred = curr;
 		pred_op = curr_op;
 		curr = next;
-		curr_op = curr->op;
+		curr_op = curr->op.load(std::memory_order_acquire);
 		
 		if(GET_FLAG(curr_op) != NONE) {
 			/*
@@ -181,28 +265,56 @@ retry:
 			 *
 			 * This call to help() can also help ensure removal of a MARKED node
 			 * for which CAS failed in helpMarked()
+			 *
+			 * With --hazard-pointers, the ops help() uses are protected
+			 * first. If either has moved on there is nothing to help.
 			 */
-			help(pred, pred_op, curr, curr_op, thread_num);
+			if (!hazard_pointers ||
+			    (keep_op(ctx, pred, pred_op) && keep_op(ctx, curr, curr_op))) {
+				help(pred, pred_op, curr, curr_op, ctx);
+			}
+			ctx->stats.find_retries++;
 			goto retry;
 		}
-		
-		curr_key = curr->key;
+
+		/*
+		 * Record curr on the path, along with the last_right that was
+		 * current on the way to it
+		 */
+		e = &path[depth % LF_PATH_LEN];
+		e->node = curr;
+		e->op = curr_op;
+		e->last_right = last_right;
+		e->last_right_op = last_right_op;
+		e->last_right_depth = last_right_depth;
+		depth++;
+		if (depth - LF_PATH_LEN > lowest) {
+			lowest = depth - LF_PATH_LEN;
+		}
+
+descend:
+		/*
+		 * Acquire pairs with the release CAS on the key in helpRelocate(),
+		 * and keeps the op validation below from being satisfied early
+		 */
+		curr_key = curr->key.load(std::memory_order_acquire);
 
 		if(key < curr_key) {
 			result = NOTFOUND_L;
+			next = curr->left.load(std::memory_order_acquire);
 			if (hazard_pointers) {
-				add_to_hp_list(thread_num, curr->left);
+				add_to_hp_list(ctx, next);
 			}
-			next = curr->left;
 		}
 		else if(key > curr_key) {
 			result = NOTFOUND_R;
+			next = curr->right.load(std::memory_order_acquire);
 			if (hazard_pointers) {
-				add_to_hp_list(thread_num, curr->right);
+				add_to_hp_list(ctx, next);
 			}
-			next = curr->right;
 			last_right = curr;
 			last_right_op = curr_op;
+			last_right_depth = depth - 1;
 		}
 		else {
 			result = FOUND;
@@ -217,26 +329,152 @@ retry:
 	 * This can happen if there was a concurrent delete operation which
 	 * replaced the key at last_right (thus increasing the search range of the 
 	 * left subtree) followed by an insert of key.
-	 * If so, retry the find() from the start.
+	 * If so, retry the find() from above last_right.
+	 *
+	 * The validating loads can be relaxed: every load before them was an
+	 * acquire, so they cannot be performed any earlier.
+	 *
+	 * With --hazard-pointers, keep_op() does the validation, and protects
+	 * the ops our caller goes on to compare against. Ops we only passed by
+	 * never needed a slot.
 	 */
-	if( (result != FOUND) && (last_right_op != last_right->op) ) {
+	if( (result != FOUND) &&
+	    (hazard_pointers ? !keep_op(ctx, last_right, last_right_op) :
+	     last_right_op != last_right->op.load(std::memory_order_relaxed)) ) {
+		ctx->stats.find_retries++;
+		depth = last_right_depth;
 		goto retry;
 	}
 
 	/*
 	 * If curr's op changed after we read its key, retry the find()
 	 */
-	if(curr_op != curr->op) {
+	if(hazard_pointers ? !keep_op(ctx, curr, curr_op) :
+	   curr_op != curr->op.load(std::memory_order_relaxed)) {
+		ctx->stats.find_retries++;
+		goto retry;
+	}
+
+	if (hazard_pointers && curr != auxRoot && !keep_op(ctx, pred, pred_op)) {
+		ctx->stats.find_retries++;
 		goto retry;
 	}
 	return result;
 }
 
-bool remove(int key, int thread_num)
+/**
+ * contains:
+ *
+ * Read-only lookup for the SEARCH path. Unlike find() it never helps and
+ * never writes to the tree, so lookups do not pay for writers' contention.
+ * It walks through nodes whose op is flagged, and decides from the state
+ * of the node holding key (or of last_right if key is absent) whether key
+ * is in the set. Only in the cases it cannot decide without helping does it
+ * fall back to find().
+ *
+ * Nodes are only safe to read without hazard pointers, so with
+ * --hazard-pointers this is just a find().
+ */
+bool contains(int key, LF_Thread_Ctx *ctx)
 {
-	LF_BST_Node *pred, *curr, *replace;
-	void *pred_op, *curr_op, *replace_op; 
+	LF_BST_Node *pred, *curr, *next, *last_right;
+	void *pred_op, *curr_op, *last_right_op;
 	Relocate_OP *reloc_op;
+	int curr_key;
+
+	if (hazard_pointers) {
+		return (find(key, pred, pred_op, curr, curr_op, base_root, ctx) == FOUND);
+	}
+
+	last_right = base_root;
+	last_right_op = base_root->op.load(std::memory_order_acquire);
+	next = base_root->right.load(std::memory_order_acquire);
+
+	while(!IS_NULL(next) && next != NULL) {
+		curr = next;
+		curr_op = curr->op.load(std::memory_order_acquire);
+		curr_key = curr->key.load(std::memory_order_acquire);
+
+		if(key < curr_key) {
+			next = curr->left.load(std::memory_order_acquire);
+			continue;
+		}
+		else if(key > curr_key) {
+			next = curr->right.load(std::memory_order_acquire);
+			last_right = curr;
+			last_right_op = curr_op;
+			continue;
+		}
+
+		/*
+		 * A node's key only changes while its op holds a RELOCATE, so if
+		 * the op is still the same, the key was key when op was read
+		 */
+		if(curr->op.load(std::memory_order_relaxed) != curr_op) {
+			goto fallback;
+		}
+
+		switch(GET_FLAG(curr_op)) {
+		case NONE:
+		case CHILDCAS:
+			// An unmarked node is never unlinked
+			return true;
+
+		case MARK:
+			/*
+			 * Logically removed, unless curr is the replace node of a
+			 * successful relocation. Then key now lives in dest, which may
+			 * or may not have been removed since.
+			 */
+			reloc_op = (Relocate_OP *)UNFLAG(curr_op);
+			if(reloc_op != NULL && reloc_op->hdr.kind == RELOCATE && reloc_op->dest != curr &&
+			   reloc_op->state.load(std::memory_order_acquire) == SUCCESSFUL) {
+				goto fallback;
+			}
+			return false;
+
+		case RELOCATE:
+			reloc_op = (Relocate_OP *)UNFLAG(curr_op);
+			if(reloc_op->dest == curr && key == reloc_op->remove_key) {
+				// The relocation removes key once it succeeds
+				return (reloc_op->state.load(std::memory_order_acquire) != SUCCESSFUL);
+			}
+			if(reloc_op->dest == curr) {
+				// key has been moved up into dest, which is not marked
+				return true;
+			}
+			/*
+			 * curr is the replace node. key stays here until the relocation
+			 * succeeds, after which it is in dest, like in the MARK case.
+			 */
+			if(reloc_op->state.load(std::memory_order_acquire) != SUCCESSFUL) {
+				return true;
+			}
+			goto fallback;
+		}
+	}
+
+	/*
+	 * Same check as in find(): a relocation that raised last_right's key
+	 * could have let key be added to last_right's left subtree. Only a
+	 * RELOCATE changes a key without changing the op, so last_right must
+	 * not be in the middle of one either.
+	 */
+	if(GET_FLAG(last_right_op) != RELOCATE &&
+	   last_right->op.load(std::memory_order_relaxed) == last_right_op) {
+		return false;
+	}
+
+fallback:
+	ctx->stats.contains_fallbacks++;
+	return (find(key, pred, pred_op, curr, curr_op, base_root, ctx) == FOUND);
+}
+
+bool remove(int key, LF_Thread_Ctx *ctx)
+{
+	LF_BST_Node *pred, *curr, *replace, *left, *right;
+	void *pred_op, *curr_op, *replace_op;
+	Relocate_OP *reloc_op = NULL;
 
 	while(true) {
 		
@@ -245,16 +483,26 @@ bool remove(int key, int thread_num)
 		 * find will return curr = the node to be deleted, pred = its predecessor,
 		 * and their corresponding op's
 		 */
-		if(find(key, pred, pred_op, curr, curr_op, base_root, thread_num) != FOUND) {
+		if(find(key, pred, pred_op, curr, curr_op, base_root, ctx) != FOUND) {
+			if (reloc_op != NULL) {
+				free_op(reloc_op, ctx);
+			}
 			return false;
 		}
 
-		if (!IS_NULL(curr->right) && hazard_pointers) {
-			add_to_hp_list(thread_num, curr->right);
+		/*
+		 * Relaxed: if either child changed since curr_op was read, the
+		 * CAS on curr->op below fails
+		 */
+		right = curr->right.load(std::memory_order_relaxed);
+		left = curr->left.load(std::memory_order_relaxed);
+
+		if (!IS_NULL(right) && hazard_pointers) {
+			add_to_hp_list(ctx, right);
 		}
 
-		if (!IS_NULL(curr->left) && hazard_pointers) {
-			add_to_hp_list(thread_num, curr->left);
+		if (!IS_NULL(left) && hazard_pointers) {
+			add_to_hp_list(ctx, left);
 		}
 
 		/*
@@ -262,59 +510,85 @@ bool remove(int key, int thread_num)
 		 * Change curr's op from NONE to MARK. At this point the node is
 		 * logically deleted from the tree.
 		 */
-		if( IS_NULL(curr->right) || IS_NULL(curr->left) ) {
+		if( IS_NULL(right) || IS_NULL(left) ) {
 			//Node has less than 2 children
-			if(__sync_bool_compare_and_swap(&curr->op, curr_op, SET_FLAG(curr_op, MARK))) {
-				helpMarked(pred, pred_op, curr, thread_num);
+			if(curr->op.cas(curr_op, SET_FLAG(curr_op, MARK),
+					std::memory_order_release, std::memory_order_relaxed)) {
+				helpMarked(pred, pred_op, curr, ctx);
 				return true;
 			}
+			ctx->stats.cas_failures++;
 		}
 		else {
 			//Node has 2 children
 			/*
-			 * Locate the node with the next largest key.
-			 * Search for the same key in curr's right subtree by doing a find() on curr.
-			 * This will either return NOTFOUND_L or NOTFOUND_R. If it returns FOUND then
-			 * there are duplicates. Good place for an assert?
+			 * Locate the node with the next largest key, carrying on from
+			 * curr in the same descent: one step right, then left as far as
+			 * possible. As long as curr does not change, only this leg is
+			 * walked again when the relocation loses a race; otherwise we
+			 * start over with the find() above.
 			 *
 			 * replace = the node with the next largest key
 			 * pred = replace's predecessor
 			 */
-			if( (find(key, pred, pred_op, replace, replace_op, curr, thread_num) == ABORT) || (curr->op != curr_op) ) {
-				continue;
-			}
+			while (find_successor(curr, curr_op, pred, pred_op, replace, replace_op, ctx)) {
+				if (hazard_pointers) {
+					add_to_hp_list(ctx, pred);
+					add_to_hp_list(ctx, curr);
+					add_to_hp_list(ctx, replace);
+				}
 
-			if (hazard_pointers) {
-				add_to_hp_list(thread_num, pred);
-				add_to_hp_list(thread_num, curr);
-				add_to_hp_list(thread_num, replace);
-			}
+				/*
+				 * reloc_op holds on to curr_op so that helpRelocate() can
+				 * compare against it later. If curr_op is already on its way
+				 * out curr has changed under us anyway.
+				 */
+				if (!retain_op(curr_op)) {
+					break;
+				}
 
-			/*
-			 * Create a new Relocate_OP.
-			 * To start with the state of the operation will be ONGOING
-			 * reloc_op's dest = curr.
-			 * curr is the node we want to remove
-			 */
-			reloc_op = new Relocate_OP;
-			reloc_op->state = ONGOING;
-			reloc_op->dest = curr;
-			reloc_op->dest_op = curr_op;
-			reloc_op->remove_key = key;
-			reloc_op->replace_key = replace->key;
+				/*
+				 * Create a new Relocate_OP, or reuse the one from the previous
+				 * iteration if it never got published.
+				 * To start with the state of the operation will be ONGOING
+				 * reloc_op's dest = curr.
+				 * curr is the node we want to remove
+				 */
+				if (reloc_op == NULL) {
+					reloc_op = alloc_reloc_op(ctx);
+				}
+				reloc_op->state.store(ONGOING, std::memory_order_relaxed);
+				reloc_op->dest = curr;
+				reloc_op->dest_op = curr_op;
+				reloc_op->remove_key = key;
+				reloc_op->replace_key = replace->key.load(std::memory_order_relaxed);
+				if (hazard_pointers) {
+					announce_op(ctx, reloc_op);
+				}
 
-			/*
-			 * Atomically try to insert this newly created operation in replace's op field
-			 * to ensure that replace's key cannot be removed while this remove is in progress
-			 */
-			if(__sync_bool_compare_and_swap(&replace->op, replace_op, SET_FLAG((void *) reloc_op, RELOCATE))) {
-				if(helpRelocate(reloc_op, pred, pred_op, replace, thread_num)) {
-					return true;
-				} else {
-					delete reloc_op;
+				/*
+				 * Atomically try to insert this newly created operation in replace's op field
+				 * to ensure that replace's key cannot be removed while this remove is in progress
+				 * Release publishes reloc_op's fields.
+				 */
+				if(replace->op.cas(replace_op, SET_FLAG((void *) reloc_op, RELOCATE),
+						   std::memory_order_release, std::memory_order_relaxed)) {
+					/*
+					 * reloc_op is visible to other threads now, from here on
+					 * its lifetime is governed by its reference count
+					 */
+					Relocate_OP *published = reloc_op;
+					reloc_op = NULL;
+
+					release_op(replace_op, ctx);
+					if(helpRelocate(published, pred, pred_op, replace, ctx)) {
+						return true;
+					}
+					break;
 				}
-			} else {
-				delete reloc_op;
+				ctx->stats.cas_failures++;
+				ctx->stats.successor_retries++;
+				release_op(curr_op, ctx);
 			}
 		}
 	}
@@ -322,123 +596,346 @@ bool remove(int key, int thread_num)
 	
 }
 
-void help(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, void *curr_op, int thread_num)
+/**
+ * find_successor:
+ *
+ * Find replace, the node with the smallest key in curr's right subtree, and
+ * its parent pred, starting from curr. If a node on the way has an ongoing
+ * operation it is helped and only the walk down from curr is redone.
+ * Returns false once curr's op is no longer curr_op, since curr may then
+ * have lost its children or its key.
+ */
+bool find_successor(LF_BST_Node *curr, void *curr_op, LF_BST_Node *&pred, void *&pred_op,
+		    LF_BST_Node *&replace, void *&replace_op, LF_Thread_Ctx *ctx)
 {
+	LF_BST_Node *next;
+
+retry:
+	if (hazard_pointers) {
+		add_to_hp_list(ctx, curr);
+	}
+
+	if (curr->op.load(std::memory_order_acquire) != curr_op) {
+		return false;
+	}
+
+	/*
+	 * The check above does not hold curr's op still: a child CAS can empty
+	 * the right child before we read it. curr's op has changed then, so we
+	 * give up as the final check would.
+	 */
+	pred = curr;
+	pred_op = curr_op;
+	replace = curr->right.load(std::memory_order_acquire);
+	if (IS_NULL(replace)) {
+		return false;
+	}
+	if (hazard_pointers) {
+		add_to_hp_list(ctx, replace);
+	}
+
+	while (true) {
+		replace_op = replace->op.load(std::memory_order_acquire);
+
+		if (GET_FLAG(replace_op) != NONE) {
+			// As in find()
+			if (!hazard_pointers ||
+			    (keep_op(ctx, pred, pred_op) && keep_op(ctx, replace, replace_op))) {
+				help(pred, pred_op, replace, replace_op, ctx);
+			}
+			ctx->stats.find_retries++;
+			goto retry;
+		}
+
+		next = replace->left.load(std::memory_order_acquire);
+		if (IS_NULL(next)) {
+			break;
+		}
+		if (hazard_pointers) {
+			add_to_hp_list(ctx, next);
+		}
+
+		pred = replace;
+		pred_op = replace_op;
+		replace = next;
+	}
+
+	/*
+	 * As in find(), curr plays the part of last_right: its key bounds the
+	 * subtree we just searched, so it must not have changed either.
+	 * A change to replace's left child is caught by the CAS on its op.
+	 */
+	if (!hazard_pointers) {
+		return (curr->op.load(std::memory_order_relaxed) == curr_op);
+	}
+
+	/*
+	 * remove() goes on to use all three ops. If only pred or replace has
+	 * moved on, walking the leg again is enough.
+	 */
+	if (!keep_op(ctx, curr, curr_op)) {
+		return false;
+	}
+	if (!keep_op(ctx, pred, pred_op) || !keep_op(ctx, replace, replace_op)) {
+		ctx->stats.find_retries++;
+		goto retry;
+	}
+	return true;
+}
+
+void help(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, void *curr_op, LF_Thread_Ctx *ctx)
+{
+	ctx->stats.helps++;
 
 	if(GET_FLAG(curr_op) == CHILDCAS) {
-		helpChildCAS( ( (Child_CAS_OP *) UNFLAG(curr_op) ), curr, thread_num);
+		helpChildCAS( ( (Child_CAS_OP *) UNFLAG(curr_op) ), curr, ctx);
 	}
 	else if(GET_FLAG(curr_op) == RELOCATE) {
-		helpRelocate( (Relocate_OP *) UNFLAG(curr_op), pred, pred_op, curr, thread_num);
+		helpRelocate( (Relocate_OP *) UNFLAG(curr_op), pred, pred_op, curr, ctx);
 	}
 	else if(GET_FLAG(curr_op) == MARK) {
-		helpMarked(pred, pred_op, curr, thread_num);
+		helpMarked(pred, pred_op, curr, ctx);
 	}
 }
 
-void add_to_hp_list(int thread_num, LF_BST_Node *node)
+void add_to_hp_list(LF_Thread_Ctx *ctx, LF_BST_Node *node)
 {
-	hp[hp_off[thread_num]] = node;
+	/*
+	 * seq_cst so that the hazard pointer is visible to hp_scan() before
+	 * this thread goes on to read through it
+	 */
+	ctx->hp[ctx->hp_off].store(node, std::memory_order_seq_cst);
 
-	hp_off[thread_num]++;
-	if (hp_off[thread_num] == thread_num * NUM_HP_PER_THREAD + NUM_HP_PER_THREAD) {
-		hp_off[thread_num] = thread_num * NUM_HP_PER_THREAD;
+	ctx->hp_off++;
+	if (ctx->hp_off == NUM_HP_PER_THREAD) {
+		ctx->hp_off = 0;
 	}
 }
 
 /**
- * helpChildCAS:
+ * keep_op:
  *
- * Determine whether the node to be added is the left or right child of dest.
- * Atomically update the pointer
- * Atomically set the operation from CHILDCAS to NONE
+ * With --hazard-pointers, protect an op read from node before reading
+ * through it or comparing against it later: announce op in this thread's
+ * next op hazard pointer slot and check that it is still node's op. If it
+ * is, it had not been retired when the slot became visible, so
+ * hp_scan_ops() leaves it alone for as long as the slot holds it. If not,
+ * the slot is reused by the next call.
+ * Like nodes, operations get recycled, and a recycled one could let a
+ * stale CAS succeed.
  */
-void helpChildCAS(Child_CAS_OP *op, LF_BST_Node *dest, int thread_num)
+bool keep_op(LF_Thread_Ctx *ctx, LF_BST_Node *node, void *op)
 {
-	if (op->is_left) {
-		add_to_hp_list(thread_num, dest->left);
-	} else {
-		add_to_hp_list(thread_num, dest->right);
+	// seq_cst for the same reason as in add_to_hp_list()
+	ctx->op_hp[ctx->op_hp_off].store(UNFLAG(op), std::memory_order_seq_cst);
+
+	if (node->op.load(std::memory_order_acquire) != op) {
+		return false;
 	}
 
-	LF_BST_Node **address = op->is_left ? (LF_BST_Node **)&dest->left : (LF_BST_Node **)&dest->right;
-	if (__sync_bool_compare_and_swap(address, op->expected, op->update) && hazard_pointers) {
+	ctx->op_hp_off++;
+	if (ctx->op_hp_off == NUM_OP_HP_PER_THREAD) {
+		ctx->op_hp_off = 0;
+	}
+	return true;
+}
+
+/**
+ * announce_op:
+ *
+ * Protect an operation this thread is about to publish, so that it outlives
+ * the help we give it after the CAS that published it, whoever finishes it.
+ * Nobody can have retired it yet, so unlike keep_op() there is nothing to
+ * check.
+ */
+void announce_op(LF_Thread_Ctx *ctx, void *op)
+{
+	ctx->op_hp[ctx->op_hp_off].store(op, std::memory_order_seq_cst);
 
-		if (UNFLAG(op->expected) != NULL) {
-			std::vector<LF_BST_Node *>::iterator rlist_vec_itr;
+	ctx->op_hp_off++;
+	if (ctx->op_hp_off == NUM_OP_HP_PER_THREAD) {
+		ctx->op_hp_off = 0;
+	}
+}
 
-			if (std::find(rlist[thread_num].begin(), rlist[thread_num].end(),
-			    (LF_BST_Node *)UNFLAG(op->expected)) == rlist[thread_num].end()) {
-				rlist[thread_num].push_back((LF_BST_Node *)UNFLAG(op->expected));
+/**
+ * hp_scan:
+ *
+ * Free every node in this thread's rlist that is not protected by a hazard
+ * pointer.
+ * The announced hazard pointers are read once into a sorted snapshot, and
+ * the rlist is partitioned into protected/free in a single pass. Since the
+ * rlist is at least HP_THRESHOLD = 2 * (number of slots) long, at least half
+ * of it gets freed, so the cost per retired node is amortized O(log slots).
+ */
+void hp_scan(LF_Thread_Ctx *ctx)
+{
+	std::vector<LF_BST_Node *> &snapshot = ctx->hp_snapshot;
+	std::vector<LF_BST_Node *> &retired = ctx->rlist;
+	size_t kept = 0;
+
+	ctx->stats.hp_scans++;
+	snapshot.clear();
+	for (int i = 0; i < num_threads; i++) {
+		for (int j = 0; j < NUM_HP_PER_THREAD; j++) {
+			LF_BST_Node *node = UNFLAG(lf_thread_ctx[i].hp[j].load(std::memory_order_seq_cst));
+			if (node != NULL) {
+				snapshot.push_back(node);
 			}
 		}
+	}
+	std::sort(snapshot.begin(), snapshot.end());
 
-		if (rlist[thread_num].size() > HP_THRESHOLD) {
-			std::vector<LF_BST_Node *>::iterator vec_itr;
-			std::vector<LF_BST_Node *> temp_rlist = rlist[thread_num];
-			for (vec_itr = temp_rlist.begin(); vec_itr != temp_rlist.end(); vec_itr++) {
-				LF_BST_Node *retired_node = *vec_itr;
-				bool ok_to_free = true;
-
-				for (int i = 0; i < MAX_THREADS * NUM_HP_PER_THREAD; i++) {
-					if (retired_node == UNFLAG(hp[i])) {
-						// Somebody has a reference to this retired node
-						// Do not delete
-						ok_to_free = false;
-						break;
-					}
-				}
+	for (size_t i = 0; i < retired.size(); i++) {
+		if (std::binary_search(snapshot.begin(), snapshot.end(), retired[i])) {
+			// Somebody has a reference to this retired node. Do not delete
+			retired[kept++] = retired[i];
+		} else {
+			// The node's last operation loses the reference the node held on it
+			release_op(retired[i]->op.load(std::memory_order_relaxed), ctx);
+			free_LF_node(retired[i], ctx);
+		}
+	}
+	retired.resize(kept);
+}
 
-				if (ok_to_free) {
-					delete retired_node;
-					rlist[thread_num].erase(std::find(rlist[thread_num].begin(),
-									  rlist[thread_num].end(),
-									  retired_node));
-				}
+/**
+ * hp_scan_ops:
+ *
+ * hp_scan() for operations: reclaim every operation in this thread's
+ * op_rlist that no op hazard pointer protects. Reclaiming a Relocate_OP
+ * releases its dest_op, which may land on op_rlist again, so the list is
+ * moved aside while it is scanned.
+ */
+void hp_scan_ops(LF_Thread_Ctx *ctx)
+{
+	std::vector<void *> &snapshot = ctx->op_hp_snapshot;
+	std::vector<void *> &retired = ctx->op_rlist_scan;
+
+	ctx->stats.hp_scans++;
+	snapshot.clear();
+	for (int i = 0; i < num_threads; i++) {
+		for (int j = 0; j < NUM_OP_HP_PER_THREAD; j++) {
+			void *op = lf_thread_ctx[i].op_hp[j].load(std::memory_order_seq_cst);
+			if (op != NULL) {
+				snapshot.push_back(op);
 			}
 		}
 	}
+	std::sort(snapshot.begin(), snapshot.end());
 
-	__sync_bool_compare_and_swap(&dest->op, SET_FLAG(op, CHILDCAS), SET_FLAG(op, NONE));
+	retired.swap(ctx->op_rlist);
+	for (size_t i = 0; i < retired.size(); i++) {
+		if (std::binary_search(snapshot.begin(), snapshot.end(), retired[i])) {
+			ctx->op_rlist.push_back(retired[i]);
+		} else {
+			reclaim_op(retired[i], ctx->thread_num);
+		}
+	}
+	retired.clear();
 }
 
-void helpMarked(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, int thread_num)
+/**
+ * helpChildCAS:
+ *
+ * Determine whether the node to be added is the left or right child of dest.
+ * Atomically update the pointer
+ * Atomically set the operation from CHILDCAS to NONE
+ */
+void helpChildCAS(Child_CAS_OP *op, LF_BST_Node *dest, LF_Thread_Ctx *ctx)
+{
+	if (hazard_pointers) {
+		if (op->is_left) {
+			add_to_hp_list(ctx, dest->left.load(std::memory_order_acquire));
+		} else {
+			add_to_hp_list(ctx, dest->right.load(std::memory_order_acquire));
+		}
+	}
+
+	/*
+	 * Release, so that a reader that acquires the new child also sees its
+	 * initialization. We saw that ourselves by acquiring dest's op.
+	 */
+	Tagged_Atomic_Ptr<LF_BST_Node> *address = op->is_left ? &dest->left : &dest->right;
+	bool swapped = address->cas(op->expected, op->update,
+				    std::memory_order_release, std::memory_order_relaxed);
+
+	if (swapped && epoch_reclamation && !IS_NULL(op->expected)) {
+		/*
+		 * expected is a real node (not a NULL-flagged pointer) only when
+		 * helpMarked() is splicing out a marked node. Only the thread
+		 * whose CAS unlinked it gets here, so it is retired exactly once.
+		 */
+		epoch_retire(ctx->thread_num, op->expected, reclaim_LF_node);
+	}
+
+	if (swapped && hazard_pointers && !IS_NULL(op->expected)) {
+		/*
+		 * Same reasoning as above: the node is unlinked exactly once, so
+		 * there is no need to check whether it is already in the rlist
+		 */
+		ctx->rlist.push_back(op->expected);
+
+		if (ctx->rlist.size() >= HP_THRESHOLD) {
+			hp_scan(ctx);
+		}
+	}
+
+	// Release: whoever reads NONE from dest's op sees the new child
+	dest->op.cas(SET_FLAG((void *) op, CHILDCAS), SET_FLAG((void *) op, NONE),
+		     std::memory_order_release, std::memory_order_relaxed);
+}
+
+void helpMarked(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, LF_Thread_Ctx *ctx)
 {
-	LF_BST_Node *new_ref;
+	LF_BST_Node *new_ref, *left, *right;
 	Child_CAS_OP *cas_op;
 	//int key;
 
 	//key = curr->key;
 
-	if(IS_NULL(curr->left)) {
+	/*
+	 * A marked node's children never change again. Acquire, because the
+	 * one we splice in is dereferenced by later readers of pred.
+	 */
+	left = curr->left.load(std::memory_order_acquire);
+	right = curr->right.load(std::memory_order_acquire);
+
+	if(IS_NULL(left)) {
 		
-		if(IS_NULL(curr->right)) {
-			new_ref = (LF_BST_Node *) SET_NULL((void *) curr);
+		if(IS_NULL(right)) {
+			new_ref = SET_NULL(curr);
 		}
 		else {
 			if (hazard_pointers) {
-				add_to_hp_list(thread_num, curr->right);
+				add_to_hp_list(ctx, right);
 			}
-			new_ref = curr->right;
+			new_ref = right;
 		}
 	}
 	else {
 		if (hazard_pointers) {
-			add_to_hp_list(thread_num, curr->left);
+			add_to_hp_list(ctx, left);
 		}
-		new_ref = curr->left;
+		new_ref = left;
 	}
 
 
-	cas_op = new Child_CAS_OP;
-	cas_op->is_left = (curr == pred->left);
+	cas_op = alloc_cas_op(ctx);
+	// Relaxed: validated by the CAS on pred->op below
+	cas_op->is_left = (curr == pred->left.load(std::memory_order_relaxed));
 	cas_op->expected = curr;
 	cas_op->update = new_ref;
+	if (hazard_pointers) {
+		announce_op(ctx, cas_op);
+	}
 
-	if(__sync_bool_compare_and_swap(&pred->op, pred_op, SET_FLAG((void *) cas_op, CHILDCAS))) {
-		helpChildCAS(cas_op, pred, thread_num);
+	if(pred->op.cas(pred_op, SET_FLAG((void *) cas_op, CHILDCAS),
+			std::memory_order_release, std::memory_order_relaxed)) {
+		release_op(pred_op, ctx);
+		helpChildCAS(cas_op, pred, ctx);
 	} else {
-		delete cas_op;
+		free_op(cas_op, ctx);
 #if 0
 		/*
 		 * pred_op may have changed since it was read so removing the marked node may fail.
@@ -446,7 +943,7 @@ void helpMarked(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, int thread_
 		 * return from this function
 		 */
 
-		if (find(key, pred, pred_op, curr, curr_op, base_root, thread_num) == ABORT) {
+		if (find(key, pred, pred_op, curr, curr_op, base_root, ctx) == ABORT) {
 			printf("find returned ABORT\n");
 			assert(0);
 		}
@@ -455,12 +952,12 @@ void helpMarked(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, int thread_
 
 }
 
-bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, int thread_num)
+bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, LF_Thread_Ctx *ctx)
 {
-	int seen_state = op->state;
+	int seen_state = op->state.load(std::memory_order_acquire);
 	
 	if (hazard_pointers) {
-		add_to_hp_list(thread_num, op->dest);
+		add_to_hp_list(ctx, op->dest);
 	}
 
 	if(seen_state == ONGOING) {
@@ -468,8 +965,13 @@ bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node
 		/*
 		 * op->dest is the node with the key that needs to be deleted.
 		 * Try to insert the Relocate_OP into op-dest's op field.
+		 *
+		 * The CASes on dest's op and on state decide the outcome for every
+		 * helper of op. Two-child removes are rare, so they keep full
+		 * acquire/release ordering rather than anything cleverer.
 		 */
-		void *seen_op = __sync_val_compare_and_swap(&op->dest->op, op->dest_op, SET_FLAG((void *) op, RELOCATE));
+		void *seen_op = op->dest->op.cas_val(op->dest_op, SET_FLAG((void *) op, RELOCATE),
+						     std::memory_order_acq_rel, std::memory_order_acquire);
 
 		/*
 		 * if the above CAS succeeded or if someone else had already inserted the Relocate_OP
@@ -479,11 +981,29 @@ bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node
 		 * to be logically removed from the set.
 		 */
 		if( (seen_op == op->dest_op) || (seen_op == SET_FLAG((void *) op, RELOCATE)) ) {
-			__sync_bool_compare_and_swap(&op->state, ONGOING, SUCCESSFUL);
+			if (seen_op == op->dest_op) {
+				// Our CAS moved op->dest off dest_op
+				release_op(op->dest_op, ctx);
+			}
+			int expected_state = ONGOING;
+			op->state.compare_exchange_strong(expected_state, SUCCESSFUL,
+							  std::memory_order_acq_rel, std::memory_order_acquire);
 			seen_state = SUCCESSFUL;
 		}
 		else {
-			seen_state = __sync_val_compare_and_swap(&op->state, ONGOING, FAILED);
+			/*
+			 * Like __sync_val_compare_and_swap(), seen_state ends up as
+			 * ONGOING iff our CAS succeeded
+			 */
+			seen_state = ONGOING;
+			if (op->state.compare_exchange_strong(seen_state, FAILED,
+							      std::memory_order_acq_rel, std::memory_order_acquire)) {
+				/*
+				 * We failed the operation, so it will never be installed in
+				 * op->dest. Drop the reference that was reserved for that.
+				 */
+				release_op(op, ctx);
+			}
 		}
 
 	}
@@ -493,8 +1013,15 @@ bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node
 	 * reset the op field to NONE
 	 */
 	if(seen_state == SUCCESSFUL) {
-		__sync_bool_compare_and_swap(&op->dest->key, op->remove_key, op->replace_key);
-		__sync_bool_compare_and_swap(&op->dest->op, SET_FLAG((void *) op, RELOCATE), SET_FLAG((void *) op, NONE));
+		/*
+		 * Release on both: a reader that sees the new key has to see dest's
+		 * op as RELOCATE (or later), and one that sees NONE the new key
+		 */
+		int remove_key = op->remove_key;
+		op->dest->key.compare_exchange_strong(remove_key, op->replace_key,
+						      std::memory_order_release, std::memory_order_relaxed);
+		op->dest->op.cas(SET_FLAG((void *) op, RELOCATE), SET_FLAG((void *) op, NONE),
+				 std::memory_order_release, std::memory_order_relaxed);
 	}
 	
 	bool result = (seen_state == SUCCESSFUL);
@@ -508,7 +1035,8 @@ bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node
 	 * So if the result was 1 mark the replace node
 	 * curr = replace -> Check the call to helpRelocate()
 	 */
-	__sync_bool_compare_and_swap(&curr->op, SET_FLAG((void *) op, RELOCATE), SET_FLAG((void *) op, result ? MARK : NONE));
+	curr->op.cas(SET_FLAG((void *) op, RELOCATE), SET_FLAG((void *) op, result ? MARK : NONE),
+		     std::memory_order_release, std::memory_order_relaxed);
 
 	if(result) {
 		if(op->dest == pred) {
@@ -516,19 +1044,254 @@ bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node
 		}
 
 		// remove curr (replace) node
-		helpMarked(pred, pred_op, curr, thread_num);
+		helpMarked(pred, pred_op, curr, ctx);
 	}
 
 	return result;
 }
 
-LF_BST_Node *create_LF_node(int key)
+LF_BST_Node *create_LF_node(int key, LF_Thread_Ctx *ctx)
 {
-	LF_BST_Node *newNode = new LF_BST_Node;
-	newNode->key = key;
-	newNode->op = NULL;
-	newNode->left = (LF_BST_Node *) SET_NULL(NULL);
-	newNode->right = (LF_BST_Node *) SET_NULL(NULL);
+	LF_BST_Node *newNode = (LF_BST_Node *)slab_alloc(ctx->thread_num, sizeof(LF_BST_Node));
+
+	// Relaxed: the node is published by a release CAS later on
+	newNode->key.store(key, std::memory_order_relaxed);
+	newNode->op.store(NULL, std::memory_order_relaxed);
+	newNode->left.store(SET_NULL((LF_BST_Node *) NULL), std::memory_order_relaxed);
+	newNode->right.store(SET_NULL((LF_BST_Node *) NULL), std::memory_order_relaxed);
 	return newNode;
 
 }
+
+struct LF_Bulk_Ops {
+	static LF_BST_Node *make(int key, int thread_num)
+	{
+		return create_LF_node(key, get_LF_thread_ctx(thread_num));
+	}
+
+	// Relaxed: the whole tree is published by bulk_load_LF()
+	static void link(LF_BST_Node *parent, LF_BST_Node *left, LF_BST_Node *right)
+	{
+		if (left != NULL) {
+			parent->left.store(left, std::memory_order_relaxed);
+		}
+		if (right != NULL) {
+			parent->right.store(right, std::memory_order_relaxed);
+		}
+	}
+};
+
+/**
+ * bulk_load_LF:
+ *
+ * Build a balanced tree out of keys, using num_threads threads, and hang it
+ * under base_root with a single store. keys ends up sorted and without
+ * duplicates. The tree must be empty and nobody else may be using it yet.
+ */
+void bulk_load_LF(std::vector<int> &keys, int num_threads)
+{
+	Bulk_Loader<LF_BST_Node, LF_Bulk_Ops> loader(keys);
+	LF_BST_Node *root;
+
+	bulk_load_prepare(keys);
+	root = loader.run(num_threads);
+	if (root != NULL) {
+		base_root->right.store(root, std::memory_order_release);
+	}
+}
+
+/*
+ * Called by the epoch reclamation code once nobody can hold a reference
+ * to the node anymore
+ */
+void reclaim_LF_node(void *ptr, int thread_num)
+{
+	LF_BST_Node *node = (LF_BST_Node *)ptr;
+	LF_Thread_Ctx *ctx = &lf_thread_ctx[thread_num];
+
+	// The node's last operation loses the reference the node held on it
+	release_op(node->op.load(std::memory_order_relaxed), ctx);
+	free_LF_node(node, ctx);
+}
+
+/*
+ * Give a node back to the slab of the thread that allocated it
+ */
+void free_LF_node(LF_BST_Node *node, LF_Thread_Ctx *ctx)
+{
+	slab_free(node, ctx->thread_num);
+}
+
+Child_CAS_OP *alloc_cas_op(LF_Thread_Ctx *ctx)
+{
+	Child_CAS_OP *op;
+
+	if (ctx->cas_op_pool.empty()) {
+		op = new Child_CAS_OP;
+	} else {
+		op = ctx->cas_op_pool.back();
+		ctx->cas_op_pool.pop_back();
+	}
+
+	op->hdr.kind = CHILDCAS;
+	op->hdr.refs.store(1, std::memory_order_relaxed);
+	return op;
+}
+
+/*
+ * A Relocate_OP starts with two references: one for replace's op field,
+ * which it is installed in first, and one reserved for dest's op field.
+ */
+Relocate_OP *alloc_reloc_op(LF_Thread_Ctx *ctx)
+{
+	Relocate_OP *op;
+
+	if (ctx->reloc_op_pool.empty()) {
+		op = new Relocate_OP;
+	} else {
+		op = ctx->reloc_op_pool.back();
+		ctx->reloc_op_pool.pop_back();
+	}
+
+	op->hdr.kind = RELOCATE;
+	op->hdr.refs.store(2, std::memory_order_relaxed);
+	return op;
+}
+
+/*
+ * Put an operation back in this thread's pool. Only for operations that
+ * were never published, or that have survived a grace period.
+ */
+void free_op(void *op, LF_Thread_Ctx *ctx)
+{
+	OP_Header *hdr = (OP_Header *)op;
+
+	if (hdr->kind == CHILDCAS) {
+		ctx->cas_op_pool.push_back((Child_CAS_OP *)op);
+	} else {
+		ctx->reloc_op_pool.push_back((Relocate_OP *)op);
+	}
+}
+
+/**
+ * retain_op:
+ *
+ * Take an extra reference on an operation read from a node's op field.
+ * Fails if the operation has already been retired.
+ * Without epoch or hazard pointer reclamation, published operations are
+ * never freed and nothing is counted.
+ */
+bool retain_op(void *op)
+{
+	OP_Header *hdr = (OP_Header *)UNFLAG(op);
+	int refs;
+
+	if (!(epoch_reclamation || hazard_pointers) || hdr == NULL) {
+		return true;
+	}
+
+	/*
+	 * Relaxed like any reference count increment: the caller already
+	 * holds a pointer it got with acquire
+	 */
+	refs = hdr->refs.load(std::memory_order_relaxed);
+	while (refs > 0) {
+		if (hdr->refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * release_op:
+ *
+ * Drop a reference on an operation. Called by the one thread whose CAS
+ * replaced op in a node's op field, and when a node or a Relocate_OP
+ * holding op is reclaimed.
+ * The last reference retires the operation.
+ */
+void release_op(void *op, LF_Thread_Ctx *ctx)
+{
+	OP_Header *hdr = (OP_Header *)UNFLAG(op);
+
+	if (!(epoch_reclamation || hazard_pointers) || hdr == NULL) {
+		return;
+	}
+
+	// acq_rel so that the last holder sees everyone else's use of op
+	if (hdr->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+		return;
+	}
+
+	if (epoch_reclamation) {
+		epoch_retire(ctx->thread_num, hdr, reclaim_op);
+		return;
+	}
+
+	/*
+	 * An operation only drops to zero once, so it is retired once. While
+	 * hp_scan_ops() is running it is left to the next scan.
+	 */
+	ctx->op_rlist.push_back(hdr);
+	if (ctx->op_rlist.size() >= OP_HP_THRESHOLD && ctx->op_rlist_scan.empty()) {
+		hp_scan_ops(ctx);
+	}
+}
+
+void reclaim_op(void *ptr, int thread_num)
+{
+	OP_Header *hdr = (OP_Header *)ptr;
+	LF_Thread_Ctx *ctx = &lf_thread_ctx[thread_num];
+
+	if (hdr->kind == RELOCATE) {
+		release_op(((Relocate_OP *)ptr)->dest_op, ctx);
+	}
+	free_op(ptr, ctx);
+}
+
+LF_Thread_Ctx *get_LF_thread_ctx(int thread_num)
+{
+	LF_Thread_Ctx *ctx = &lf_thread_ctx[thread_num];
+
+	ctx->thread_num = thread_num;
+	return ctx;
+}
+
+/*
+ * Nodes and operations on the hazard pointer retired lists, over all
+ * threads. Only exact while no thread is inside an operation.
+ */
+unsigned long hp_pending(void)
+{
+	unsigned long pending = 0;
+
+	for (int i = 0; i < MAX_THREADS; i++) {
+		pending += lf_thread_ctx[i].rlist.size() + lf_thread_ctx[i].op_rlist.size();
+	}
+	return pending;
+}
+
+void print_LF_stats()
+{
+	LF_Stats total = {0, 0, 0, 0, 0, 0, 0, 0};
+
+	for (int i = 0; i < MAX_THREADS; i++) {
+		total.find_retries += lf_thread_ctx[i].stats.find_retries;
+		total.helps += lf_thread_ctx[i].stats.helps;
+		total.cas_failures += lf_thread_ctx[i].stats.cas_failures;
+		total.hp_scans += lf_thread_ctx[i].stats.hp_scans;
+		total.contains_fallbacks += lf_thread_ctx[i].stats.contains_fallbacks;
+		total.local_restarts += lf_thread_ctx[i].stats.local_restarts;
+		total.restart_nodes_saved += lf_thread_ctx[i].stats.restart_nodes_saved;
+		total.successor_retries += lf_thread_ctx[i].stats.successor_retries;
+	}
+
+	printf("Lock-free tree: find retries %lu, helps %lu, CAS failures %lu, hazard pointer scans %lu, "
+	       "contains() fallbacks %lu\n", total.find_retries, total.helps, total.cas_failures,
+	       total.hp_scans, total.contains_fallbacks);
+	printf("Lock-free tree: find local restarts %lu, nodes not re-traversed %lu (%.1f per restart)\n",
+	       total.local_restarts, total.restart_nodes_saved,
+	       total.local_restarts ? (double)total.restart_nodes_saved / total.local_restarts : 0.0);
+	printf("Lock-free tree: successor leg retries %lu\n", total.successor_retries);
+}
@@ -1,11 +1,31 @@
 #ifndef _LOCK_FREE_BST_H_
 #define _LOCK_FREE_BST_H_
 
-#define ONE				0x00000001
-#define TWO				0x00000002
-#define THREE				0x00000003
-#define HP_THRESHOLD			6
+#include <atomic>
+#include <vector>
+
+#include "threads.h"
+#include "Epoch_Reclaim.h"
+#include "Tagged_Ptr.h"
+
 #define NUM_HP_PER_THREAD               10
+/*
+ * Scan the hazard pointers once a thread has retired twice as many nodes as
+ * there are hazard pointer slots in use. This guarantees every scan frees
+ * at least half of the rlist.
+ */
+#define HP_THRESHOLD			((size_t)2 * num_threads * NUM_HP_PER_THREAD)
+/*
+ * Operations have hazard pointer slots and a retired list of their own,
+ * scanned on the same terms as the nodes'.
+ */
+#define NUM_OP_HP_PER_THREAD		10
+#define OP_HP_THRESHOLD			((size_t)2 * num_threads * NUM_OP_HP_PER_THREAD)
+/*
+ * Number of nodes find() remembers on its way down, to resume from after
+ * a conflict. Deeper paths keep only their bottom LF_PATH_LEN nodes.
+ */
+#define LF_PATH_LEN			32
 
 enum flag_type {
 	NONE = 0,
@@ -27,47 +47,130 @@ enum operation_state {
 	FAILED
 };
 
+/*
+ * key only changes when a relocation moves the successor's key into a
+ * node, op carries a flag_type in its low bits, and an empty child is a
+ * SET_NULL() pointer.
+ */
 typedef struct Lock_Free_BST_Node {
-	int volatile key;
-	void * volatile op;
-	struct Lock_Free_BST_Node * volatile left;
-	struct Lock_Free_BST_Node *volatile right;
+	std::atomic<int> key;
+	Tagged_Atomic_Ptr<void> op;
+	Tagged_Atomic_Ptr<struct Lock_Free_BST_Node> left;
+	Tagged_Atomic_Ptr<struct Lock_Free_BST_Node> right;
 } LF_BST_Node;
 
+/*
+ * Common header of Child_CAS_OP and Relocate_OP.
+ * refs counts the places an operation can still be reached from: the op
+ * fields of tree nodes that point to it, and the dest_op of a Relocate_OP.
+ * It is only maintained with epoch or hazard pointer reclamation. Once it
+ * drops to zero the operation is retired and, after a grace period or once
+ * no op hazard pointer protects it, goes back to a per-thread pool.
+ */
+typedef struct Operation_Header {
+	std::atomic<int> refs;
+	int kind;
+} OP_Header;
+
+/*
+ * Apart from state and refs, the fields of an operation are written before
+ * it is published by a release CAS on some node's op, and never change
+ * while it is reachable, so they need not be atomic.
+ */
 typedef struct Child_Compare_And_Swap_Operation {
+	OP_Header hdr;
 	bool is_left;
-	LF_BST_Node * volatile expected;
-	LF_BST_Node * volatile update;
+	LF_BST_Node *expected;
+	LF_BST_Node *update;
 } Child_CAS_OP;
 
 typedef struct Relocate_Operation {
-	int volatile state;
-	LF_BST_Node * volatile dest;
+	OP_Header hdr;
+	std::atomic<int> state;
+	LF_BST_Node *dest;
 	void *dest_op;
 	int remove_key;
 	int replace_key;
 } Relocate_OP;
 
-void *SET_FLAG(void *ptr, int state);
-int GET_FLAG(void *ptr);
-void *UNFLAG(void *ptr);
-void *SET_NULL(void *ptr);
-bool IS_NULL(void *ptr);
-void test_ptr_functions();
+/*
+ * A node on find()'s path, with the op it had when we passed it and the
+ * last_right that was current when we got there
+ */
+typedef struct Lock_Free_BST_Path_Entry {
+	LF_BST_Node *node;
+	void *op;
+	LF_BST_Node *last_right;
+	void *last_right_op;
+	int last_right_depth;
+} LF_Path_Entry;
+
+typedef struct Lock_Free_BST_Stats {
+	unsigned long find_retries;
+	unsigned long helps;
+	unsigned long cas_failures;
+	unsigned long hp_scans;
+	unsigned long contains_fallbacks;
+	unsigned long local_restarts;
+	unsigned long restart_nodes_saved;
+	unsigned long successor_retries;
+} LF_Stats;
+
+/*
+ * Per-thread state of the lock-free tree.
+ * The hazard pointer slots are the only part other threads read (in
+ * hp_scan() and hp_scan_ops()); everything after them is private to the
+ * owning thread and starts on a new cache line. The struct itself is cache
+ * line aligned, so neighbouring threads' contexts never share a line.
+ */
+struct alignas(CACHE_LINE_SIZE) LF_Thread_Ctx {
+	std::atomic<LF_BST_Node *> hp[NUM_HP_PER_THREAD];
+	std::atomic<void *> op_hp[NUM_OP_HP_PER_THREAD];
+	alignas(CACHE_LINE_SIZE) int thread_num;
+	int hp_off;
+	int op_hp_off;
+	std::vector<LF_BST_Node *> rlist;
+	std::vector<LF_BST_Node *> hp_snapshot;
+	std::vector<void *> op_rlist;
+	std::vector<void *> op_rlist_scan;
+	std::vector<void *> op_hp_snapshot;
+	std::vector<Child_CAS_OP *> cas_op_pool;
+	std::vector<Relocate_OP *> reloc_op_pool;
+	LF_Stats stats;
+};
 
 //Main BST functions
-void add(int key, int thread_num);
-int find(int key, LF_BST_Node *&pred, void *&pred_op, LF_BST_Node *&curr, void *&curr_op, LF_BST_Node *auxRoot, int thread_num);
-bool remove(int key, int thread_num);
+void add(int key, LF_Thread_Ctx *ctx);
+int find(int key, LF_BST_Node *&pred, void *&pred_op, LF_BST_Node *&curr, void *&curr_op, LF_BST_Node *auxRoot, LF_Thread_Ctx *ctx);
+bool remove(int key, LF_Thread_Ctx *ctx);
+bool contains(int key, LF_Thread_Ctx *ctx);
+bool find_successor(LF_BST_Node *curr, void *curr_op, LF_BST_Node *&pred, void *&pred_op,
+		    LF_BST_Node *&replace, void *&replace_op, LF_Thread_Ctx *ctx);
 
 //helper functions
-void help(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, void *curr_op, int thread_num);
-void helpChildCAS(Child_CAS_OP *op, LF_BST_Node *dest, int thread_num);
-void helpMarked(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, int thread_num);
-void helpRelocateMarked(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, int thread_num);
-bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, int thread_num);
+void help(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, void *curr_op, LF_Thread_Ctx *ctx);
+void helpChildCAS(Child_CAS_OP *op, LF_BST_Node *dest, LF_Thread_Ctx *ctx);
+void helpMarked(LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, LF_Thread_Ctx *ctx);
+void helpRelocateMarked(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, LF_Thread_Ctx *ctx);
+bool helpRelocate(Relocate_OP *op, LF_BST_Node *pred, void *pred_op, LF_BST_Node *curr, LF_Thread_Ctx *ctx);
 
 //other functions
-LF_BST_Node *create_LF_node(int key);
-void add_to_hp_list(int thread_num, LF_BST_Node *node);
+LF_Thread_Ctx *get_LF_thread_ctx(int thread_num);
+void print_LF_stats();
+LF_BST_Node *create_LF_node(int key, LF_Thread_Ctx *ctx);
+void bulk_load_LF(std::vector<int> &keys, int num_threads);
+void free_LF_node(LF_BST_Node *node, LF_Thread_Ctx *ctx);
+void add_to_hp_list(LF_Thread_Ctx *ctx, LF_BST_Node *node);
+void hp_scan(LF_Thread_Ctx *ctx);
+bool keep_op(LF_Thread_Ctx *ctx, LF_BST_Node *node, void *op);
+void announce_op(LF_Thread_Ctx *ctx, void *op);
+void hp_scan_ops(LF_Thread_Ctx *ctx);
+unsigned long hp_pending(void);
+void reclaim_LF_node(void *ptr, int thread_num);
+Child_CAS_OP *alloc_cas_op(LF_Thread_Ctx *ctx);
+Relocate_OP *alloc_reloc_op(LF_Thread_Ctx *ctx);
+void free_op(void *op, LF_Thread_Ctx *ctx);
+bool retain_op(void *op);
+void release_op(void *op, LF_Thread_Ctx *ctx);
+void reclaim_op(void *ptr, int thread_num);
 #endif
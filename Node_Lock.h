@@ -0,0 +1,332 @@
+#ifndef _NODE_LOCK_H_
+#define _NODE_LOCK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+
+/*
+ * Locks for the nodes of the fine-grained tree. The node type takes one of
+ * these as a template parameter, picked at compile time (FG_LOCK in the
+ * Makefile). They all have the same interface:
+ *	init(), destroy(), lock(), unlock(), lock_shared(), unlock_shared(),
+ *	and static name() and has_shared()
+ * Any of them can be locked in one function and unlocked in another, as
+ * hand-over-hand locking does. Locks without a real shared mode
+ * (has_shared() is false) take lock_shared() exclusively; the tree's
+ * reader-writer mode refuses to run on them.
+ *
+ * Hand-over-hand locks are held for a handful of instructions, so the
+ * spinning locks spin first. They yield once they have backed off to the
+ * limit, because the holder may well be preempted: with more threads than
+ * cores, spinning any longer only keeps it from running.
+ */
+#define NODE_LOCK_MAX_BACKOFF		1024
+#define NODE_LOCK_MCS_SLOTS		8
+
+static inline void node_lock_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/*
+ * Spin for backoff iterations, then double it. At the limit, yield
+ * instead.
+ */
+static inline void node_lock_backoff(unsigned &backoff)
+{
+	if (backoff >= NODE_LOCK_MAX_BACKOFF) {
+		sched_yield();
+		return;
+	}
+
+	for (unsigned i = 0; i < backoff; i++) {
+		node_lock_pause();
+	}
+	backoff <<= 1;
+}
+
+/*
+ * What the tree always used: 40 bytes, and a trip into glibc per call
+ */
+class Pthread_Lock {
+public:
+	void init() { pthread_mutex_init(&mutex, NULL); }
+	void destroy() { pthread_mutex_destroy(&mutex); }
+	void lock() { pthread_mutex_lock(&mutex); }
+	void unlock() { pthread_mutex_unlock(&mutex); }
+	void lock_shared() { lock(); }
+	void unlock_shared() { unlock(); }
+	static const char *name() { return "pthread"; }
+	static bool has_shared() { return false; }
+
+private:
+	pthread_mutex_t mutex;
+};
+
+/*
+ * The glibc rwlock, for the reader-writer mode: 56 bytes. By default glibc
+ * lets new readers in ahead of a waiting writer, which can keep an
+ * upgrade() out for good under a read-heavy load, so writers are preferred
+ * here. That is only safe because no thread takes the same lock shared
+ * twice.
+ */
+class Pthread_RW_Lock {
+public:
+	void init()
+	{
+		pthread_rwlockattr_t attr;
+
+		pthread_rwlockattr_init(&attr);
+		pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+		pthread_rwlock_init(&rwlock, &attr);
+		pthread_rwlockattr_destroy(&attr);
+	}
+
+	void destroy() { pthread_rwlock_destroy(&rwlock); }
+	void lock() { pthread_rwlock_wrlock(&rwlock); }
+	void unlock() { pthread_rwlock_unlock(&rwlock); }
+	void lock_shared() { pthread_rwlock_rdlock(&rwlock); }
+	void unlock_shared() { pthread_rwlock_unlock(&rwlock); }
+	static const char *name() { return "pthread-rw"; }
+	static bool has_shared() { return true; }
+
+private:
+	pthread_rwlock_t rwlock;
+};
+
+/*
+ * Test-and-test-and-set with exponential backoff. One byte.
+ */
+class TATAS_Lock {
+public:
+	void init() { locked.store(false, std::memory_order_relaxed); }
+	void destroy() {}
+
+	void lock()
+	{
+		unsigned backoff = 1;
+
+		while (locked.exchange(true, std::memory_order_acquire)) {
+			// Wait on a plain load, so waiters don't bounce the line
+			while (locked.load(std::memory_order_relaxed)) {
+				node_lock_backoff(backoff);
+			}
+		}
+	}
+
+	void unlock() { locked.store(false, std::memory_order_release); }
+	void lock_shared() { lock(); }
+	void unlock_shared() { unlock(); }
+	static const char *name() { return "tatas"; }
+	static bool has_shared() { return false; }
+
+private:
+	std::atomic<bool> locked;
+};
+
+/*
+ * TATAS with a count of shared holders in the same word. Four bytes. A
+ * waiting writer sets the pending bit, which keeps new shared holders out
+ * until it gets in; otherwise a steady stream of them could keep the count
+ * from ever dropping to zero, and upgrade() would wait forever. Taking the
+ * lock clears the bit, and any other waiting writer sets it again.
+ */
+#define TATAS_WRITER			1U
+#define TATAS_PENDING			2U
+#define TATAS_READER			4U
+
+class TATAS_RW_Lock {
+public:
+	void init() { state.store(0, std::memory_order_relaxed); }
+	void destroy() {}
+
+	void lock()
+	{
+		unsigned backoff = 1;
+		uint32_t s = state.load(std::memory_order_relaxed);
+
+		for (;;) {
+			if ((s & ~TATAS_PENDING) == 0) {
+				if (state.compare_exchange_weak(s, TATAS_WRITER, std::memory_order_acquire,
+								std::memory_order_relaxed)) {
+					return;
+				}
+				continue;
+			}
+
+			if (!(s & TATAS_PENDING)) {
+				state.fetch_or(TATAS_PENDING, std::memory_order_relaxed);
+			}
+			node_lock_backoff(backoff);
+			s = state.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Waiters may be setting the pending bit, so only the writer bit goes
+	void unlock() { state.fetch_and(~TATAS_WRITER, std::memory_order_release); }
+
+	void lock_shared()
+	{
+		unsigned backoff = 1;
+
+		while (state.fetch_add(TATAS_READER, std::memory_order_acquire) &
+		       (TATAS_WRITER | TATAS_PENDING)) {
+			state.fetch_sub(TATAS_READER, std::memory_order_relaxed);
+			while (state.load(std::memory_order_relaxed) & (TATAS_WRITER | TATAS_PENDING)) {
+				node_lock_backoff(backoff);
+			}
+		}
+	}
+
+	void unlock_shared() { state.fetch_sub(TATAS_READER, std::memory_order_release); }
+	static const char *name() { return "tatas-rw"; }
+	static bool has_shared() { return true; }
+
+private:
+	std::atomic<uint32_t> state;
+};
+
+/*
+ * FIFO ticket lock. Four bytes, which caps the number of waiters at 65535.
+ * A waiter backs off in proportion to the number of tickets ahead of it.
+ */
+class Ticket_Lock {
+public:
+	void init()
+	{
+		next.store(0, std::memory_order_relaxed);
+		owner.store(0, std::memory_order_relaxed);
+	}
+
+	void destroy() {}
+
+	void lock()
+	{
+		uint16_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+		uint16_t current;
+		unsigned spins = 0;
+
+		while ((current = owner.load(std::memory_order_acquire)) != ticket) {
+			if (++spins > NODE_LOCK_MAX_BACKOFF) {
+				sched_yield();
+				continue;
+			}
+			for (unsigned i = 0; i < (uint16_t)(ticket - current); i++) {
+				node_lock_pause();
+			}
+		}
+	}
+
+	void unlock()
+	{
+		// Only the holder writes owner
+		owner.store(owner.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void lock_shared() { lock(); }
+	void unlock_shared() { unlock(); }
+	static const char *name() { return "ticket"; }
+	static bool has_shared() { return false; }
+
+private:
+	std::atomic<uint16_t> next;
+	std::atomic<uint16_t> owner;
+};
+
+/*
+ * MCS queue lock. The lock itself is just the queue's tail pointer; every
+ * waiter spins on its own queue node. Each thread has a few queue nodes,
+ * one per lock it holds, and finds the right one again at unlock() by the
+ * lock it was used for.
+ */
+class MCS_Lock {
+public:
+	void init() { tail.store(NULL, std::memory_order_relaxed); }
+	void destroy() {}
+
+	void lock()
+	{
+		Qnode *q = get_qnode(NULL);
+		Qnode *prev;
+		unsigned backoff = 1;
+
+		q->lock = this;
+		q->next.store(NULL, std::memory_order_relaxed);
+		q->locked.store(true, std::memory_order_relaxed);
+
+		prev = tail.exchange(q, std::memory_order_acq_rel);
+		if (prev == NULL) {
+			return;
+		}
+
+		prev->next.store(q, std::memory_order_release);
+		while (q->locked.load(std::memory_order_acquire)) {
+			node_lock_backoff(backoff);
+		}
+	}
+
+	void unlock()
+	{
+		Qnode *q = get_qnode(this);
+		Qnode *next = q->next.load(std::memory_order_acquire);
+		unsigned backoff = 1;
+
+		if (next == NULL) {
+			Qnode *expected = q;
+
+			if (tail.compare_exchange_strong(expected, NULL, std::memory_order_release,
+							 std::memory_order_relaxed)) {
+				q->lock = NULL;
+				return;
+			}
+
+			// A waiter is about to link itself in behind us
+			while ((next = q->next.load(std::memory_order_acquire)) == NULL) {
+				node_lock_backoff(backoff);
+			}
+		}
+
+		next->locked.store(false, std::memory_order_release);
+		q->lock = NULL;
+	}
+
+	void lock_shared() { lock(); }
+	void unlock_shared() { unlock(); }
+	static const char *name() { return "mcs"; }
+	static bool has_shared() { return false; }
+
+private:
+	struct Qnode {
+		std::atomic<Qnode *> next;
+		std::atomic<bool> locked;
+		const MCS_Lock *lock;	// NULL while the slot is free
+	};
+
+	/*
+	 * The calling thread's queue node for lock, or a free one for NULL
+	 */
+	static Qnode *get_qnode(const MCS_Lock *lock)
+	{
+		static thread_local Qnode qnodes[NODE_LOCK_MCS_SLOTS];
+
+		for (int i = 0; i < NODE_LOCK_MCS_SLOTS; i++) {
+			if (qnodes[i].lock == lock) {
+				return &qnodes[i];
+			}
+		}
+
+		fprintf(stderr, "MCS_Lock: a thread holds more than %d node locks\n",
+			NODE_LOCK_MCS_SLOTS);
+		abort();
+	}
+
+	std::atomic<Qnode *> tail;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef _RAND_H_
+#define _RAND_H_
+
+#include <stdint.h>
+
+/*
+ * Small, fast PRNG for generating operations: xorshift64* (Vigna, "An
+ * experimental exploration of Marsaglia's xorshift generators, scrambled",
+ * 2016). Every thread keeps its own state, so drawing a number touches no
+ * shared memory. Not for anything that needs real randomness.
+ */
+typedef struct Rand_State {
+	uint64_t state;
+} Rand_State;
+
+/*
+ * Seeds go through splitmix64 first, so that seeds that differ in a bit or
+ * two (like a base seed plus a thread number) still give unrelated streams,
+ * and so that no seed leaves the all-zero state xorshift can't get out of
+ */
+static inline void rand_seed(Rand_State *r, uint64_t seed)
+{
+	uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	r->state = z ? z : 1;
+}
+
+static inline uint64_t rand_next(Rand_State *r)
+{
+	uint64_t x = r->state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	r->state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Uniform in [0, n), by multiplying instead of dividing (Lemire, "Fast
+ * Random Integer Generation in an Interval", 2019, without the rejection
+ * step; the bias is below n / 2^64)
+ */
+static inline uint64_t rand_below(Rand_State *r, uint64_t n)
+{
+	return (uint64_t)(((unsigned __int128)rand_next(r) * n) >> 64);
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <atomic>
+
+#include "Slab_Alloc.h"
+#include "threads.h"
+
+/*
+ * Per-thread slab allocator.
+ *
+ * Every thread carves objects out of its own 2MB chunks, so the allocation
+ * fast path is a pop from a private free list or a pointer bump, with no
+ * atomics and no shared malloc arenas. An object freed by its owner goes
+ * straight back on the owner's free list. An object freed by some other
+ * thread (e.g. a node retired by whoever won the CAS that unlinked it) is
+ * pushed onto the owner's remote free stack, which the owner takes over in
+ * one exchange once its private list runs dry.
+ */
+extern bool huge_pages;
+Slab_Thread slab_threads[MAX_THREADS];
+
+static int size_class(size_t size)
+{
+	int c = 0;
+	size_t class_size = SLAB_MIN_SIZE;
+
+	while (class_size < size) {
+		class_size <<= 1;
+		c++;
+	}
+
+	if (c >= NUM_SIZE_CLASSES) {
+		fprintf(stderr, "slab_alloc: no size class for %zu bytes\n", size);
+		abort();
+	}
+	return c;
+}
+
+static bool new_chunk(int thread_num, int c)
+{
+	Slab_Class *sc = &slab_threads[thread_num].classes[c];
+	size_t class_size = SLAB_MIN_SIZE << c;
+	size_t lead, usable;
+	char *raw, *chunk;
+	Slab_Chunk *header;
+
+	/*
+	 * Over-allocate and trim so the chunk is aligned to its own size
+	 */
+	raw = (char *)mmap(NULL, 2 * SLAB_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) {
+		return false;
+	}
+
+	chunk = (char *)(((uintptr_t)raw + SLAB_CHUNK_SIZE - 1) & ~(SLAB_CHUNK_SIZE - 1));
+	lead = chunk - raw;
+	if (lead != 0) {
+		munmap(raw, lead);
+	}
+	munmap(chunk + SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE - lead);
+
+	if (huge_pages) {
+		madvise(chunk, SLAB_CHUNK_SIZE, MADV_HUGEPAGE);
+	}
+
+	header = (Slab_Chunk *)chunk;
+	header->owner = thread_num;
+	header->size_class = c;
+
+	// objects start on the first cache line after the header
+	usable = SLAB_CHUNK_SIZE - CACHE_LINE_SIZE;
+	sc->bump = chunk + CACHE_LINE_SIZE;
+	sc->bump_end = sc->bump + (usable / class_size) * class_size;
+	slab_threads[thread_num].chunks++;
+
+	return true;
+}
+
+void *slab_alloc(int thread_num, size_t size)
+{
+	int c = size_class(size);
+	Slab_Class *sc = &slab_threads[thread_num].classes[c];
+	void *obj = sc->free_list;
+
+	if (obj == NULL) {
+		// Take back everything other threads have freed on our behalf
+		obj = sc->remote_free.exchange(NULL, std::memory_order_acquire);
+	}
+
+	if (obj != NULL) {
+		sc->free_list = *(void **)obj;
+		return obj;
+	}
+
+	if (sc->bump == sc->bump_end && !new_chunk(thread_num, c)) {
+		fprintf(stderr, "slab_alloc: out of memory\n");
+		abort();
+	}
+
+	obj = sc->bump;
+	sc->bump += SLAB_MIN_SIZE << c;
+	return obj;
+}
+
+/**
+ * slab_free:
+ *
+ * Give an object back to the thread whose chunk it came from.
+ * thread_num is the thread doing the free.
+ */
+void slab_free(void *ptr, int thread_num)
+{
+	Slab_Chunk *chunk = (Slab_Chunk *)((uintptr_t)ptr & ~(SLAB_CHUNK_SIZE - 1));
+	Slab_Class *sc = &slab_threads[chunk->owner].classes[chunk->size_class];
+	void *head;
+
+	if (chunk->owner == thread_num) {
+		*(void **)ptr = sc->free_list;
+		sc->free_list = ptr;
+		return;
+	}
+
+	/*
+	 * Only the owner ever pops, and it always takes the whole stack at
+	 * once, so this push cannot suffer from ABA
+	 */
+	head = sc->remote_free.load(std::memory_order_relaxed);
+	do {
+		*(void **)ptr = head;
+	} while (!sc->remote_free.compare_exchange_weak(head, ptr, std::memory_order_release,
+						       std::memory_order_relaxed));
+}
+
+void slab_print_stats()
+{
+	unsigned long chunks = 0;
+
+	for (int i = 0; i < MAX_THREADS; i++) {
+		chunks += slab_threads[i].chunks;
+	}
+
+	printf("Slab allocator: %lu chunks, %lu MB%s\n", chunks,
+	       chunks * SLAB_CHUNK_SIZE / (1024 * 1024),
+	       huge_pages ? " (huge pages requested)" : "");
+}
@@ -0,0 +1,56 @@
+#ifndef _SLAB_ALLOC_H_
+#define _SLAB_ALLOC_H_
+
+#include <stddef.h>
+#include <atomic>
+
+#include "threads.h"
+#include "Epoch_Reclaim.h"
+
+/*
+ * Chunks are 2MB and 2MB aligned, so that with --huge-pages every chunk can
+ * be backed by a single huge page, and so that the owner of any object can
+ * be found by masking its address.
+ */
+#define SLAB_CHUNK_SIZE			(2UL * 1024 * 1024)
+#define NUM_SIZE_CLASSES		5
+
+/*
+ * Size classes are 16, 32, 64, 128 and 256 bytes. The small ones divide a
+ * cache line and the big ones are multiples of it, and chunks hand out
+ * objects from a cache line aligned start, so no object ever straddles two
+ * cache lines more than it has to.
+ */
+#define SLAB_MIN_SIZE			16
+
+/*
+ * Header at the start of every chunk
+ */
+typedef struct Slab_Chunk_Header {
+	int owner;
+	int size_class;
+} Slab_Chunk;
+
+/*
+ * Per-thread, per-size-class state.
+ * free_list and the bump range are private to the owner. remote_free is a
+ * stack other threads push onto when they free an object of ours; it gets
+ * its own cache line so remote frees don't disturb the owner's fast path.
+ */
+struct alignas(CACHE_LINE_SIZE) Slab_Class {
+	void *free_list;
+	char *bump;
+	char *bump_end;
+	alignas(CACHE_LINE_SIZE) std::atomic<void *> remote_free;
+};
+
+struct Slab_Thread {
+	Slab_Class classes[NUM_SIZE_CLASSES];
+	unsigned long chunks;
+};
+
+void *slab_alloc(int thread_num, size_t size);
+void slab_free(void *ptr, int thread_num);
+void slab_print_stats();
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _TAGGED_PTR_H_
+#define _TAGGED_PTR_H_
+
+#include <stdint.h>
+#include <atomic>
+
+#define ONE				0x00000001
+#define TWO				0x00000002
+#define THREE				0x00000003
+
+/*
+ * Flag helpers for pointers that carry state in their low two bits.
+ * All the nodes and operations are at least 4 byte aligned, so those bits
+ * are free. These are inline so that checking a pointer on the traversal
+ * path costs a couple of instructions instead of a call.
+ */
+template <typename T>
+inline T *SET_FLAG(T *ptr, int state)
+{
+	return (T *)((uintptr_t)ptr | (uintptr_t)state);
+}
+
+inline int GET_FLAG(const void *ptr)
+{
+	return (int)((uintptr_t)ptr & (uintptr_t)THREE);
+}
+
+template <typename T>
+inline T *UNFLAG(T *ptr)
+{
+	return (T *)((uintptr_t)ptr & ~(uintptr_t)THREE);
+}
+
+/*
+ * An empty child is not NULL but a pointer with its lowest bit set, so that
+ * a CAS expecting an empty child fails once the child has been filled and
+ * emptied again.
+ */
+template <typename T>
+inline T *SET_NULL(T *ptr)
+{
+	return (T *)((uintptr_t)ptr | (uintptr_t)ONE);
+}
+
+inline bool IS_NULL(const void *ptr)
+{
+	return ((uintptr_t)ptr & (uintptr_t)ONE) != 0;
+}
+
+/*
+ * An atomic pointer that may carry flag bits.
+ * There are no defaults for the memory order: every access in the tree
+ * states the ordering it relies on.
+ */
+template <typename T>
+class Tagged_Atomic_Ptr {
+public:
+	T *load(std::memory_order order) const
+	{
+		return ptr.load(order);
+	}
+
+	void store(T *val, std::memory_order order)
+	{
+		ptr.store(val, order);
+	}
+
+	int flag(std::memory_order order) const
+	{
+		return GET_FLAG(ptr.load(order));
+	}
+
+	/*
+	 * Same contract as __sync_bool_compare_and_swap(), but with explicit
+	 * ordering for the success and failure cases
+	 */
+	bool cas(T *expected, T *desired, std::memory_order success,
+		 std::memory_order failure)
+	{
+		return ptr.compare_exchange_strong(expected, desired, success, failure);
+	}
+
+	/*
+	 * Same contract as __sync_val_compare_and_swap(): returns the value
+	 * that was seen, which equals expected iff the swap happened
+	 */
+	T *cas_val(T *expected, T *desired, std::memory_order success,
+		   std::memory_order failure)
+	{
+		ptr.compare_exchange_strong(expected, desired, success, failure);
+		return expected;
+	}
+
+	/*
+	 * Set flag bits without touching the pointer, whatever it is.
+	 * Returns the previous value.
+	 */
+	T *fetch_flag(int state, std::memory_order order)
+	{
+		T *old = ptr.load(std::memory_order_relaxed);
+
+		while (!ptr.compare_exchange_weak(old, SET_FLAG(old, state), order,
+						  std::memory_order_relaxed));
+		return old;
+	}
+
+private:
+	std::atomic<T *> ptr;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <algorithm>
+#include <vector>
+
+#include "Thread_Pin.h"
+
+struct Pin_CPU {
+	int cpu;
+	int package;
+	int core;		// core_id, only unique within a package
+	int core_rank;		// which core of its package, counting from 0
+	int smt;		// which hardware thread of its core, counting from 0
+};
+
+static const char *policy_names[] = {"none", "compact", "scatter", "smt-off"};
+
+static int read_topology_id(int cpu, const char *name)
+{
+	char path[128];
+	FILE *file;
+	int id = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+	if (fscanf(file, "%d", &id) != 1) {
+		id = -1;
+	}
+	fclose(file);
+	return id;
+}
+
+/*
+ * Socket by socket, core by core, and the SMT siblings of a core together
+ */
+static bool compact_order(const Pin_CPU &a, const Pin_CPU &b)
+{
+	if (a.package != b.package)
+		return a.package < b.package;
+	if (a.core != b.core)
+		return a.core < b.core;
+	return a.cpu < b.cpu;
+}
+
+/*
+ * The first core of every socket, then the second, and so on, and the
+ * second hardware thread of any core only after the first of every core
+ */
+static bool scatter_order(const Pin_CPU &a, const Pin_CPU &b)
+{
+	if (a.smt != b.smt)
+		return a.smt < b.smt;
+	if (a.core_rank != b.core_rank)
+		return a.core_rank < b.core_rank;
+	return a.package < b.package;
+}
+
+static bool is_smt_sibling(const Pin_CPU &c)
+{
+	return c.smt != 0;
+}
+
+/*
+ * Every CPU we may run on, with its place in the machine. Without sysfs
+ * every CPU is taken to be a core of its own.
+ */
+static void read_topology(std::vector<Pin_CPU> &cpus)
+{
+	cpu_set_t allowed;
+	Pin_CPU c;
+
+	cpus.clear();
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return;
+	}
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed)) {
+			continue;
+		}
+
+		c.cpu = cpu;
+		c.package = read_topology_id(cpu, "physical_package_id");
+		c.core = read_topology_id(cpu, "core_id");
+		if (c.package < 0 || c.core < 0) {
+			c.package = 0;
+			c.core = cpu;
+		}
+		cpus.push_back(c);
+	}
+
+	std::sort(cpus.begin(), cpus.end(), compact_order);
+
+	// Sorted by package and core, so siblings are next to each other
+	for (size_t i = 0; i < cpus.size(); i++) {
+		if (i == 0 || cpus[i].package != cpus[i - 1].package) {
+			cpus[i].core_rank = 0;
+			cpus[i].smt = 0;
+		} else if (cpus[i].core != cpus[i - 1].core) {
+			cpus[i].core_rank = cpus[i - 1].core_rank + 1;
+			cpus[i].smt = 0;
+		} else {
+			cpus[i].core_rank = cpus[i - 1].core_rank;
+			cpus[i].smt = cpus[i - 1].smt + 1;
+		}
+	}
+}
+
+int pin_policy_parse(const char *name)
+{
+	for (int i = 0; i < (int)(sizeof(policy_names) / sizeof(policy_names[0])); i++) {
+		if (strcmp(name, policy_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *pin_policy_name(int policy)
+{
+	return policy_names[policy];
+}
+
+/**
+ * pin_plan:
+ *
+ * The CPU for each of num_threads threads under policy, in thread order.
+ * Leaves cpus empty for PIN_NONE. With more threads than CPUs, compact and
+ * scatter start over from the first CPU.
+ */
+int pin_plan(int policy, int num_threads, std::vector<int> &cpus)
+{
+	std::vector<Pin_CPU> topology;
+
+	cpus.clear();
+	if (policy == PIN_NONE) {
+		return 0;
+	}
+
+	read_topology(topology);
+	if (topology.empty()) {
+		fprintf(stderr, "pin: cannot read this process's CPU affinity\n");
+		return -EINVAL;
+	}
+
+	if (policy == PIN_SCATTER) {
+		std::stable_sort(topology.begin(), topology.end(), scatter_order);
+	} else if (policy == PIN_SMT_OFF) {
+		topology.erase(std::remove_if(topology.begin(), topology.end(), is_smt_sibling),
+			       topology.end());
+		if (num_threads > (int)topology.size()) {
+			fprintf(stderr, "pin: %d threads, but only %zu cores to run them on without SMT\n",
+				num_threads, topology.size());
+			return -EINVAL;
+		}
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		cpus.push_back(topology[i % topology.size()].cpu);
+	}
+	return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef _THREAD_PIN_H_
+#define _THREAD_PIN_H_
+
+#include <vector>
+
+/*
+ * Where the worker threads run.
+ *
+ * PIN_COMPACT fills every hardware thread of a core before moving on to the
+ * next core, and every core of a socket before the next socket, so threads
+ * share as much cache as they can. PIN_SCATTER puts consecutive threads on
+ * different sockets, then different cores, and only doubles up on a core's
+ * SMT siblings once every core has a thread. PIN_SMT_OFF runs one thread per
+ * physical core, in compact order, and refuses to run more threads than
+ * there are cores. PIN_NONE leaves placement to the scheduler.
+ *
+ * Only the CPUs the process may run on are used, so the plans respect
+ * taskset and cgroup limits.
+ */
+enum pin_policy {
+	PIN_NONE,
+	PIN_COMPACT,
+	PIN_SCATTER,
+	PIN_SMT_OFF
+};
+
+int pin_policy_parse(const char *name);
+const char *pin_policy_name(int policy);
+int pin_plan(int policy, int num_threads, std::vector<int> &cpus);
+
+#endif
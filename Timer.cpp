@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "Timer.h"
+
+bool timer_use_tsc = false;
+double timer_ns_per_tick = 1.0;
+
+/*
+ * An invariant TSC ticks at the same rate in every P-, C- and T-state, so
+ * it can be turned into time with a single factor
+ */
+static bool tsc_is_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+		return false;
+	}
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx & (1U << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+static double timespec_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1e9 + ts->tv_nsec;
+}
+
+/**
+ * timer_init:
+ *
+ * Switch to the TSC if it is usable, and measure how fast it runs. Call
+ * once, before any thread takes timestamps.
+ */
+void timer_init(void)
+{
+	struct timespec start, end, delay = {0, TIMER_CALIBRATION_NS};
+	uint64_t start_ticks, end_ticks;
+
+	if (!tsc_is_invariant()) {
+		printf("Timer: no invariant TSC, using clock_gettime()\n");
+		return;
+	}
+
+	timer_use_tsc = true;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	start_ticks = timer_ticks();
+	nanosleep(&delay, NULL);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+	end_ticks = timer_ticks();
+
+	timer_ns_per_tick = (timespec_ns(&end) - timespec_ns(&start)) / (end_ticks - start_ticks);
+}
+
+/**
+ * timer_wait_until:
+ *
+ * Return once timer_ticks() reaches due. A long wait sleeps until
+ * TIMER_SPIN_NS before due, which is more than a sleep usually oversleeps
+ * by, and spins the rest of the way, so the wait ends on time without
+ * burning a CPU for all of it.
+ */
+void timer_wait_until(uint64_t due)
+{
+	uint64_t now = timer_ticks();
+	double wait_ns;
+	struct timespec delay;
+
+	if (due <= now) {
+		return;
+	}
+
+	wait_ns = timer_ticks_to_ns(due - now);
+	if (wait_ns > 2 * TIMER_SPIN_NS) {
+		wait_ns -= TIMER_SPIN_NS;
+		delay.tv_sec = (time_t)(wait_ns * 1e-9);
+		delay.tv_nsec = (long)(wait_ns - delay.tv_sec * 1e9);
+		nanosleep(&delay, NULL);
+	}
+
+	while (timer_ticks() < due) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Timestamps for the harness.
+ *
+ * On x86 with an invariant TSC, a tick is a TSC cycle, read with a fence
+ * on either side so that the code being timed can neither start before the
+ * first read nor still be running at the second. timer_init() measures the
+ * TSC rate against CLOCK_MONOTONIC_RAW. Anywhere else, and before
+ * timer_init(), a tick is a CLOCK_MONOTONIC nanosecond.
+ */
+#define TIMER_CALIBRATION_NS		20000000
+// timer_wait_until() spins for the last this many ns instead of sleeping
+#define TIMER_SPIN_NS			100000
+
+extern bool timer_use_tsc;
+extern double timer_ns_per_tick;
+
+static inline uint64_t timer_ticks(void)
+{
+	struct timespec ts;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (timer_use_tsc) {
+		uint64_t ticks;
+
+		__builtin_ia32_lfence();
+		ticks = __builtin_ia32_rdtsc();
+		__builtin_ia32_lfence();
+		return ticks;
+	}
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline double timer_ticks_to_ns(uint64_t ticks)
+{
+	return ticks * timer_ns_per_tick;
+}
+
+static inline double timer_seconds(void)
+{
+	return timer_ticks_to_ns(timer_ticks()) * 1e-9;
+}
+
+void timer_init(void);
+void timer_wait_until(uint64_t due);
+
+#endif
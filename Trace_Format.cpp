@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Trace_Format.h"
+
+/*
+ * The harness deals records out of the mapping as they are, so they had
+ * better be laid out the way it expects
+ */
+static_assert(sizeof(WORK) == 16 && offsetof(WORK, value) == 0 && offsetof(WORK, op_type) == 4 &&
+	      offsetof(WORK, arrival) == 8, "binary trace records must match struct work");
+static_assert(sizeof(Trace_Header) == 64, "binary trace header must stay 64 bytes");
+
+bool trace_is_binary(const char *path)
+{
+	uint64_t magic = 0;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		return false;
+	}
+	if (read(fd, &magic, sizeof(magic)) != sizeof(magic)) {
+		magic = 0;
+	}
+	close(fd);
+	return magic == TRACE_MAGIC;
+}
+
+/*
+ * Everything the header says has to fit the file exactly, and the phases
+ * have to be in order, since the harness trusts them blindly afterwards
+ */
+static bool trace_valid(const Trace_Map *map)
+{
+	const Trace_Header *h = map->header;
+	uint64_t prev = 0;
+
+	if (map->length < sizeof(Trace_Header) || h->magic != TRACE_MAGIC ||
+	    h->version != TRACE_VERSION || h->record_size != sizeof(WORK) || h->num_phases == 0) {
+		return false;
+	}
+	if (h->num_records > (map->length - sizeof(Trace_Header)) / sizeof(WORK) ||
+	    sizeof(Trace_Header) + h->num_records * sizeof(WORK) +
+	    h->num_phases * sizeof(Trace_Phase) != map->length) {
+		return false;
+	}
+
+	for (uint64_t i = 0; i < h->num_phases; i++) {
+		if ((i == 0 && map->phases[i].start != 0) || map->phases[i].start < prev ||
+		    map->phases[i].start > h->num_records) {
+			return false;
+		}
+		prev = map->phases[i].start;
+	}
+	return true;
+}
+
+/**
+ * trace_map:
+ *
+ * Map the binary trace at path. The pages are read in by mmap() itself
+ * (MAP_POPULATE), so that the workers don't take page faults in the middle
+ * of the measured run. Returns -EINVAL if the file isn't a valid trace.
+ */
+int trace_map(Trace_Map *map, const char *path)
+{
+	struct stat st;
+	int fd, ret = 0;
+
+	memset(map, 0, sizeof(*map));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+	if (fstat(fd, &st) != 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	map->length = st.st_size;
+	map->base = mmap(NULL, map->length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (map->base == MAP_FAILED) {
+		ret = -errno;
+		close(fd);
+		memset(map, 0, sizeof(*map));
+		return ret;
+	}
+	close(fd);
+
+	map->header = (const Trace_Header *)map->base;
+	map->records = (const WORK *)(map->header + 1);
+	if (map->length >= sizeof(Trace_Header) &&
+	    map->header->num_records <= (map->length - sizeof(Trace_Header)) / sizeof(WORK)) {
+		map->phases = (const Trace_Phase *)(map->records + map->header->num_records);
+	}
+
+	if (!trace_valid(map)) {
+		trace_unmap(map);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+void trace_unmap(Trace_Map *map)
+{
+	if (map->base != NULL) {
+		munmap(map->base, map->length);
+	}
+	memset(map, 0, sizeof(*map));
+}
+
+static int write_all(int fd, const void *data, size_t length)
+{
+	const char *pos = (const char *)data;
+	ssize_t ret;
+
+	while (length > 0) {
+		ret = write(fd, pos, length);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		pos += ret;
+		length -= ret;
+	}
+	return 0;
+}
+
+static int flush_records(Trace_Writer *writer)
+{
+	int ret = write_all(writer->fd, writer->buf, writer->buf_len * sizeof(WORK));
+
+	writer->buf_len = 0;
+	return ret;
+}
+
+/*
+ * Writers are big, because of the buffer: keep them static or on the heap
+ */
+int trace_writer_open(Trace_Writer *writer, const char *path)
+{
+	Trace_Phase first;
+	int ret;
+
+	writer->fd = creat(path, 0644);
+	if (writer->fd < 0) {
+		return -errno;
+	}
+
+	memset(&writer->header, 0, sizeof(writer->header));
+	writer->header.magic = TRACE_MAGIC;
+	writer->header.version = TRACE_VERSION;
+	writer->header.record_size = sizeof(WORK);
+
+	memset(&first, 0, sizeof(first));
+	writer->phases.assign(1, first);
+	writer->timed = 0;
+	writer->buf_len = 0;
+
+	// A placeholder, until close knows the counts
+	ret = write_all(writer->fd, &writer->header, sizeof(writer->header));
+	if (ret != 0) {
+		close(writer->fd);
+		unlink(path);
+	}
+	return ret;
+}
+
+int trace_write_op(Trace_Writer *writer, int op_type, int value, uint64_t arrival, bool timed)
+{
+	WORK *w;
+
+	if (writer->buf_len == TRACE_WRITE_BUF && flush_records(writer) != 0) {
+		return -EIO;
+	}
+
+	w = &writer->buf[writer->buf_len++];
+	memset(w, 0, sizeof(*w));
+	w->value = value;
+	w->op_type = op_type;
+	w->arrival = arrival;
+
+	writer->phases.back().ops[op_type]++;
+	writer->header.num_records++;
+	if (timed) {
+		writer->timed++;
+	}
+	return 0;
+}
+
+/*
+ * Start a new phase at the next record. Like a "phase" line in a text
+ * trace, it only names the current phase if nothing has been written to
+ * that yet.
+ */
+int trace_write_phase(Trace_Writer *writer)
+{
+	Trace_Phase next;
+
+	if (writer->header.num_records > writer->phases.back().start) {
+		memset(&next, 0, sizeof(next));
+		next.start = writer->header.num_records;
+		writer->phases.push_back(next);
+	}
+	return 0;
+}
+
+int trace_writer_close(Trace_Writer *writer)
+{
+	int ret;
+
+	writer->header.num_phases = writer->phases.size();
+	if (writer->header.num_records > 0 && writer->timed == writer->header.num_records) {
+		writer->header.flags |= TRACE_HAS_ARRIVALS;
+	}
+
+	ret = flush_records(writer);
+	if (ret == 0) {
+		ret = write_all(writer->fd, writer->phases.data(),
+				writer->phases.size() * sizeof(Trace_Phase));
+	}
+	if (ret == 0 && pwrite(writer->fd, &writer->header, sizeof(writer->header), 0) !=
+	    (ssize_t)sizeof(writer->header)) {
+		ret = -EIO;
+	}
+
+	if (close(writer->fd) != 0 && ret == 0) {
+		ret = -errno;
+	}
+	return ret;
+}
@@ -0,0 +1,77 @@
+#ifndef _TRACE_FORMAT_H_
+#define _TRACE_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "test_harness.h"
+
+/*
+ * Binary traces, for loading big traces without parsing them.
+ *
+ * A file is a Trace_Header, then num_records records, then num_phases
+ * Trace_Phase entries. A record is a WORK exactly as the harness hands it
+ * to the workers (arrival in ns, op_type an enum operation_type), so the
+ * harness maps the file and deals batches of records out of the mapping as
+ * they are, with nothing read, parsed or copied up front. Everything is in
+ * the byte order of the machine that wrote it; a file from a machine of
+ * the other order fails the magic check.
+ *
+ * The phase table comes last so that a trace can be written in one pass.
+ * There is always at least one phase, starting at record 0.
+ */
+#define TRACE_MAGIC			0x3145434152545342ULL	// "BSTRACE1"
+#define TRACE_VERSION			1
+#define TRACE_HAS_ARRIVALS		0x1	// every record has an arrival time
+
+typedef struct Trace_Header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t num_records;
+	uint64_t num_phases;
+	uint64_t flags;
+	uint64_t reserved[3];
+} Trace_Header;
+
+typedef struct Trace_Phase {
+	uint64_t start;			// its first record
+	uint64_t ops[NUM_OP_TYPES];
+} Trace_Phase;
+
+/*
+ * Buffered, one-pass writer
+ */
+#define TRACE_WRITE_BUF			(64 * 1024)
+
+typedef struct Trace_Writer {
+	int fd;
+	Trace_Header header;
+	std::vector<Trace_Phase> phases;
+	unsigned long timed;		// records written with an arrival time
+	size_t buf_len;
+	WORK buf[TRACE_WRITE_BUF];
+} Trace_Writer;
+
+/*
+ * A binary trace, mapped read-only
+ */
+typedef struct Trace_Map {
+	void *base;
+	size_t length;
+	const Trace_Header *header;
+	const WORK *records;
+	const Trace_Phase *phases;
+} Trace_Map;
+
+bool trace_is_binary(const char *path);
+int trace_map(Trace_Map *map, const char *path);
+void trace_unmap(Trace_Map *map);
+
+int trace_writer_open(Trace_Writer *writer, const char *path);
+int trace_write_op(Trace_Writer *writer, int op_type, int value, uint64_t arrival, bool timed);
+int trace_write_phase(Trace_Writer *writer);
+int trace_writer_close(Trace_Writer *writer);
+
+#endif
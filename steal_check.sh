@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Replays a trace that inserts keys and then deletes them again, with
+# enough threads that batches get stolen, and checks each tree against the
+# trace afterwards. A delete that overtakes its insert leaves the key
+# behind and fails the check.
+
+create=traces/create_tree_big.txt
+trace=traces/tracegen.insert.delete.10000
+status=0
+stolen=0
+
+for threads in 4 24 64; do
+	for variant in "" "--optimistic" "--lock-free" "--lock-free --hazard-pointers" \
+		       "--lock-free --epoch" "--chromatic" "--external"; do
+		out=$(./test --create-file=$create --test-file=$trace --correctness=1 \
+			     --threads=$threads $variant 2>&1)
+		if [ $? -ne 0 ] || echo "$out" | grep -q "not correctly\|not present\|NOT VALID"; then
+			echo "FAIL --threads=$threads $variant"
+			status=1
+		else
+			echo "ok   --threads=$threads $variant"
+		fi
+
+		if ! echo "$out" | grep -q " 0 batches stolen"; then
+			stolen=1
+		fi
+	done
+done
+
+if [ $stolen -eq 0 ]; then
+	echo "FAIL no batches were stolen, so stealing went unchecked"
+	status=1
+fi
+exit $status
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <fstream>
 #include <string>
 #include <vector>
@@ -11,30 +13,71 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <time.h>
+#include <sys/resource.h>
 
 #include "Fine_Grained_BST.h"
 #include "Lock_Free_BST.h"
+#include "Chromatic_BST.h"
+#include "External_BST.h"
+#include "Epoch_Reclaim.h"
+#include "Slab_Alloc.h"
 #include "threads.h"
-#include "work_queue.h"
+#include "work_dispatch.h"
 #include "test_harness.h"
-#include "cycle_timer.h"
+#include "Timer.h"
+#include "Latency_Hist.h"
+#include "Thread_Pin.h"
+#include "Rand.h"
+#include "Trace_Format.h"
 
 
-extern int hp_off[MAX_THREADS];
-pthread_mutex_t tree_lock;
 FG_BST_Node *g_root = NULL;
 LF_BST_Node *base_root = NULL;
 bool hazard_pointers = false;
+bool epoch_reclamation = false;
+bool huge_pages = false;
+bool serial_create = false;
+bool optimistic_reads = false;
+bool rw_locks = false;
+bool dispatch_only = false;
+bool record_latency = false;
+int num_threads = DEFAULT_THREADS;
+int pin_policy = PIN_NONE;
+std::vector<int> sweep_threads;	// thread counts to run, with --sweep
+double duration = 0;			// seconds measured, with --duration
+double warmup = DEFAULT_WARMUP;		// seconds run before that
+int op_mix[NUM_OP_TYPES] = {DEFAULT_INSERT_PCT, DEFAULT_SEARCH_PCT, DEFAULT_DELETE_PCT};
+int key_range = DEFAULT_KEY_RANGE;
+unsigned long op_seed = DEFAULT_SEED;
+int arrivals = ARRIVALS_CLOSED;
+double offered_rate = 0;		// ops/s over all threads, open loop
+std::vector<double> sweep_rates;	// offered loads to run, with --rate-sweep
 std::map<int, std::vector<FG_BST_Node *> > level_Map_FG; //this map is used purely for printing/debugging
 std::map<int, std::vector<LF_BST_Node *> > level_Map_LF; //this map is used purely for printing/debugging
 std::vector<int> tree_values_FG; //this vector is purely for debugging purposes
 std::vector<int> tree_values_LF; //this vector is purely for debugging purposes
+std::vector<int> tree_values_CT; //this vector is purely for debugging purposes
+std::vector<int> tree_values_EXT; //this vector is purely for debugging purposes
 
 // this vector is used to determine algorithm correctness
 std::vector<int> tree_values_correctness;
-WorkQueue<WORK> *wq; 
-bool all_threads_created = false;
-bool perform_FG_test;
+Work_Dispatch<WORK> work_dispatch;
+std::vector<Phase_Stats> trace_phases;	// always at least one
+Trace_Map test_trace;			// the --test-file, if it is binary
+pthread_barrier_t start_barrier;
+pthread_barrier_t phase_barrier;
+static thread_local size_t op_trace_phase;
+std::atomic<int> bench_phase;
+static thread_local int op_phase;
+static thread_local Rand_State op_rand;
+uint64_t schedule_start;		// when the open loop schedules start
+static thread_local double op_due;	// this thread's next scheduled start
+static thread_local double op_interval;	// and its mean gap, in ticks
+static const char *arrival_names[] = {"closed", "poisson", "fixed", "trace"};
+Latency_Hist op_latency[MAX_THREADS][NUM_OP_TYPES];
+int tree_type;
 unsigned long perform_correctness = 0;
 char create_file[PATH_MAX], test_file[PATH_MAX];
 
@@ -44,154 +87,615 @@ void print_LF_Tree(LF_BST_Node *root);
 void add_LF_TreeToMap(LF_BST_Node *root, int level);
 void check_valid_FG_Tree();
 void check_valid_LF_Tree();
+void check_valid_CT_Tree();
+void check_valid_EXT_Tree();
 void populate_tree_values_FG(FG_BST_Node *root);
 void populate_tree_values_LF(LF_BST_Node *root);
+void populate_tree_values_CT(CT_Node *root);
+void populate_tree_values_EXT(EXT_Node *root);
+int tree_height_FG(FG_BST_Node *root);
+int tree_height_LF(LF_BST_Node *root);
+int tree_height_CT(CT_Node *root);
+int tree_height_EXT(EXT_Node *root);
+void print_peak_rss();
+void print_throughput(struct thread_info *tinfo, double run_time);
+void print_phases(void);
+void print_latency(void);
+void print_summary(struct thread_info *tinfo, size_t keys, double build_time, double run_time);
+void print_csv_header(void);
+void print_csv_row(struct thread_info *tinfo, size_t keys, double build_time, double run_time);
 
 static struct option long_options[] = 
 {
 	{"create-file", required_argument, 0, 'c'},
 	{"test-file", required_argument, 0, 't'},
 	{"lock-free", no_argument, 0, 'l'},
+	{"chromatic", no_argument, 0, 'r'},
+	{"external", no_argument, 0, 'x'},
 	{"correctness", required_argument, 0, 'o'},
-	{"hazard-pointers", no_argument, 0, 'h'}
+	{"hazard-pointers", no_argument, 0, 'h'},
+	{"epoch", no_argument, 0, 'e'},
+	{"huge-pages", no_argument, 0, 'g'},
+	{"serial-create", no_argument, 0, 's'},
+	{"optimistic", no_argument, 0, 'p'},
+	{"rw-locks", no_argument, 0, 'w'},
+	{"dispatch-only", no_argument, 0, 'd'},
+	{"latency", no_argument, 0, 'y'},
+	{"threads", required_argument, 0, 'n'},
+	{"pin", required_argument, 0, 'a'},
+	{"sweep", required_argument, 0, 'S'},
+	{"duration", required_argument, 0, 'D'},
+	{"warmup", required_argument, 0, 'W'},
+	{"mix", required_argument, 0, 'm'},
+	{"key-range", required_argument, 0, 'k'},
+	{"seed", required_argument, 0, 'E'},
+	{"rate", required_argument, 0, 'R'},
+	{"arrivals", required_argument, 0, 'A'},
+	{"rate-sweep", required_argument, 0, 'L'},
+	{"replay-timing", no_argument, 0, 'T'},
+	{0, 0, 0, 0}
 };
 
+/*
+ * Ticks from one of this thread's scheduled starts to the next. Poisson
+ * gaps are drawn by inverting the exponential distribution, from a uniform
+ * in (0, 1].
+ */
+static inline double next_interarrival(void)
+{
+	if (arrivals == ARRIVALS_FIXED) {
+		return op_interval;
+	}
+	return -log(((rand_next(&op_rand) >> 11) + 1) / 9007199254740992.0) * op_interval;
+}
+
+/*
+ * The workers and the main thread all meet here, so the measured phase
+ * starts once every thread exists and nobody gets a head start. Each
+ * worker first clears its histograms, which a sweep reuses from run to run.
+ */
+static void start_ops(struct thread_info *tinfo)
+{
+	if (record_latency) {
+		for (int op = 0; op < NUM_OP_TYPES; op++) {
+			latency_hist_reset(&op_latency[tinfo->thread_num][op]);
+		}
+	}
+
+	op_phase = PHASE_WARMUP;
+	op_trace_phase = 0;
+	rand_seed(&op_rand, op_seed + tinfo->thread_num);
+
+	pthread_barrier_wait(&start_barrier);
+	tinfo->start_time = timer_seconds();
+
+	/*
+	 * Every thread runs its own schedule at its share of the rate. The
+	 * sum of Poisson arrivals is Poisson at the whole rate; fixed ones are
+	 * staggered so that they interleave evenly.
+	 */
+	if (arrivals == ARRIVALS_POISSON || arrivals == ARRIVALS_FIXED) {
+		op_interval = 1e9 * num_threads / offered_rate / timer_ns_per_tick;
+		op_due = schedule_start + (arrivals == ARRIVALS_FIXED ?
+					   op_interval * tinfo->thread_num / num_threads :
+					   next_interarrival());
+	}
+}
+
+static void finish_ops(struct thread_info *tinfo, unsigned long ops)
+{
+	tinfo->end_time = timer_seconds();
+	tinfo->ops = ops;
+}
+
+/*
+ * Open loop: hold the operation back until its scheduled start, and
+ * return that as its start, so that time spent queued behind slower
+ * operations counts towards its latency instead of going unrecorded
+ */
+static uint64_t wait_for_arrival(const WORK *work)
+{
+	uint64_t due;
+
+	if (arrivals == ARRIVALS_TRACE) {
+		due = schedule_start + (uint64_t)(work->arrival / timer_ns_per_tick);
+	} else {
+		due = (uint64_t)op_due;
+		op_due += next_interarrival();
+	}
+
+	timer_wait_until(due);
+	return due;
+}
+
+/*
+ * With --latency, every operation is timed into its thread's histogram
+ * for its type
+ */
+static inline uint64_t op_begin(const WORK *work)
+{
+	if (arrivals != ARRIVALS_CLOSED) {
+		return wait_for_arrival(work);
+	}
+	return record_latency ? timer_ticks() : 0;
+}
+
+static inline void op_end(struct thread_info *tinfo, int op_type, uint64_t start)
+{
+	if (record_latency) {
+		latency_hist_record(&op_latency[tinfo->thread_num][op_type], timer_ticks() - start);
+	}
+}
+
+/*
+ * With --duration, operations are made up as they are needed, until the
+ * main thread says stop. Whatever was done during the warmup is forgotten
+ * once the measured window opens: the operation count, the histograms and
+ * the start time all start over.
+ */
+static bool generate_work(struct thread_info *tinfo, WORK *work, unsigned long *ops)
+{
+	int phase = bench_phase.load(std::memory_order_relaxed);
+	uint64_t pct;
+
+	if (phase != op_phase) {
+		if (op_phase == PHASE_WARMUP) {
+			*ops = 0;
+			for (int op = 0; record_latency && op < NUM_OP_TYPES; op++) {
+				latency_hist_reset(&op_latency[tinfo->thread_num][op]);
+			}
+			tinfo->start_time = timer_seconds();
+		}
+		op_phase = phase;
+		if (phase == PHASE_STOP) {
+			return false;
+		}
+	}
+
+	pct = rand_below(&op_rand, 100);
+	if (pct < (uint64_t)op_mix[INSERT]) {
+		work->op_type = INSERT;
+	} else if (pct < (uint64_t)(op_mix[INSERT] + op_mix[SEARCH])) {
+		work->op_type = SEARCH;
+	} else {
+		work->op_type = DELETE;
+	}
+	work->value = rand_below(&op_rand, key_range);
+
+	return true;
+}
+
+static size_t phase_end(size_t phase)
+{
+	return phase + 1 < trace_phases.size() ? trace_phases[phase + 1].start : work_dispatch.size();
+}
+
+/*
+ * Resident set size right now, where print_peak_rss() has the high water
+ * mark
+ */
+static long current_rss_kb(void)
+{
+	FILE *file = fopen("/proc/self/statm", "r");
+	long pages = 0;
+
+	if (file == NULL) {
+		return 0;
+	}
+	if (fscanf(file, "%*s %ld", &pages) != 1) {
+		pages = 0;
+	}
+	fclose(file);
+	return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int tree_height(void)
+{
+	if (tree_type == FG_TREE) {
+		return tree_height_FG(g_root->right);
+	} else if (tree_type == LF_TREE) {
+		return tree_height_LF(base_root);
+	} else if (tree_type == CHROMATIC_TREE) {
+		return tree_height_CT(get_chromatic_root());
+	}
+	return tree_height_EXT(get_external_root());
+}
+
+/*
+ * Take stock at the end of a phase. Only called while no worker is inside
+ * an operation: between phases, or once they are all joined.
+ */
+static void end_phase(size_t phase, double end_time)
+{
+	Phase_Stats *p = &trace_phases[phase];
+
+	p->end_time = end_time;
+	p->rss_kb = current_rss_kb();
+	p->retired = epoch_reclamation ? epoch_pending() : (hazard_pointers ? hp_pending() : 0);
+	p->height = dispatch_only ? 0 : tree_height();
+}
+
+/*
+ * A worker that has run out of its phase waits here for all the others.
+ * One of them then takes stock and deals out the next phase while the rest
+ * wait some more. Returns false after the last phase.
+ */
+static bool next_trace_phase(void)
+{
+	size_t next = op_trace_phase + 1;
+
+	if (next >= trace_phases.size()) {
+		return false;
+	}
+
+	if (pthread_barrier_wait(&phase_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+		end_phase(op_trace_phase, timer_seconds());
+		work_dispatch.seal(num_threads, trace_phases[next].start, phase_end(next));
+		trace_phases[next].start_time = timer_seconds();
+	}
+	pthread_barrier_wait(&phase_barrier);
+
+	op_trace_phase = next;
+	return true;
+}
+
+static bool get_trace_work(struct thread_info *tinfo, WORK *work)
+{
+	while (!work_dispatch.get_work(tinfo->thread_num, work)) {
+		if (!next_trace_phase()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Next operation for a worker, off the trace or generated
+ */
+static inline bool get_work(struct thread_info *tinfo, WORK *work, unsigned long *ops)
+{
+	if (duration > 0) {
+		return generate_work(tinfo, work, ops);
+	}
+	return get_trace_work(tinfo, work);
+}
+
 void *perform_ops_FG(void *thread_args)
 {
 	WORK work;
 	int work_value;
+	unsigned long ops = 0;
+	uint64_t start;
 	struct thread_info *tinfo = (struct thread_info *)thread_args;
 
-	while (!all_threads_created);
+	start_ops(tinfo);
 
-	while (wq->get_queue_size() > 0) {
-		work = wq->get_work();
+	while (get_work(tinfo, &work, &ops)) {
 		work_value = work.value;
+		ops++;
+		start = op_begin(&work);
+
+		if (optimistic_reads) {
+			// Keeps the nodes optimistic readers look at from being freed
+			epoch_enter(tinfo->thread_num);
+
+			if (work.op_type == INSERT) {
+				insert_optimistic(work_value, tinfo->thread_num);
+			} else if (work.op_type == SEARCH) {
+				search_optimistic(work_value);
+			} else if (work.op_type == DELETE) {
+				remove_optimistic(work_value, tinfo->thread_num);
+			}
 
-		if (work.op_type == INSERT) {
-			insert(work_value, g_root, NULL, tinfo->thread_num);
-		} else if (work.op_type == SEARCH) {
-			search(work_value, g_root, NULL);
-		} else if (work.op_type == DELETE) {
-			remove(work_value, g_root, tinfo->thread_num);
+			epoch_exit(tinfo->thread_num);
+		} else if (rw_locks) {
+			if (work.op_type == INSERT) {
+				insert_rw(work_value, tinfo->thread_num);
+			} else if (work.op_type == SEARCH) {
+				search_rw(work_value);
+			} else if (work.op_type == DELETE) {
+				remove_rw(work_value, tinfo->thread_num);
+			}
+		} else {
+			if (work.op_type == INSERT) {
+				insert(work_value, g_root, NULL, tinfo->thread_num);
+			} else if (work.op_type == SEARCH) {
+				search(work_value, g_root, NULL);
+			} else if (work.op_type == DELETE) {
+				remove(work_value, g_root, tinfo->thread_num);
+			}
 		}
+
+		op_end(tinfo, work.op_type, start);
 	}
 
+	finish_ops(tinfo, ops);
+
 	return 0;
 }
 
 void *perform_ops_LF(void *thread_args)
 {
 	WORK work;
-	int work_value, result;
-	LF_BST_Node *pred, *curr;
-	void *pred_op, *curr_op;
+	int work_value;
+	unsigned long ops = 0;
+	uint64_t start;
 	struct thread_info *tinfo = (struct thread_info *)thread_args;
+	LF_Thread_Ctx *ctx = get_LF_thread_ctx(tinfo->thread_num);
 	
-	while (!all_threads_created);
+	start_ops(tinfo);
 
-	while (wq->get_queue_size() > 0) {
-		work = wq->get_work();
+	while (get_work(tinfo, &work, &ops)) {
 		work_value = work.value;
+		ops++;
+		start = op_begin(&work);
+
+		/*
+		 * Everything between enter and exit may hold references into the
+		 * tree, so nothing retired in the meantime is freed
+		 */
+		if (epoch_reclamation) {
+			epoch_enter(tinfo->thread_num);
+		}
 
 		if (work.op_type == INSERT) {
-			add(work_value, tinfo->thread_num);
+			add(work_value, ctx);
 		} else if (work.op_type == SEARCH) {
-			result = find(work_value, pred, pred_op, curr, curr_op, base_root, tinfo->thread_num);
-			if (result == FOUND) {
+			if (contains(work_value, ctx)) {
 				//printf("Found the node with value %d\n", work_value);
-			} else if (result == ABORT) {
-				//printf("Could not find the node with value %d\n", work_value);
-				assert(0);
 			}
 		} else if (work.op_type == DELETE) {
-			remove(work_value, tinfo->thread_num);
+			remove(work_value, ctx);
 		}
+
+		if (epoch_reclamation) {
+			epoch_exit(tinfo->thread_num);
+		}
+
+		op_end(tinfo, work.op_type, start);
 	}
 
+	finish_ops(tinfo, ops);
+
 	return 0;
 }
 
-int init_harness(void)
+void *perform_ops_CT(void *thread_args)
 {
-	int thread_count = 0, ret;
-	pthread_attr_t attr;
-	struct thread_info *tinfo;
+	WORK work;
+	int work_value;
+	unsigned long ops = 0;
+	uint64_t start;
+	struct thread_info *tinfo = (struct thread_info *)thread_args;
+	CT_Thread_Ctx *ctx = get_CT_thread_ctx(tinfo->thread_num);
 
-	if(perform_FG_test) {
-	 	//Initialize the root mutex for fine-grained tree
-		pthread_mutex_init(&tree_lock, NULL);
-	}
-	else {
-		//Intialize auxiliary/base root for lock-free tree
-		base_root = create_LF_node(-1);
+	start_ops(tinfo);
+
+	while (get_work(tinfo, &work, &ops)) {
+		work_value = work.value;
+		ops++;
+		start = op_begin(&work);
+
+		if (epoch_reclamation) {
+			epoch_enter(tinfo->thread_num);
+		}
+
+		if (work.op_type == INSERT) {
+			chromatic_insert(work_value, ctx);
+		} else if (work.op_type == SEARCH) {
+			chromatic_contains(work_value, ctx);
+		} else if (work.op_type == DELETE) {
+			chromatic_remove(work_value, ctx);
+		}
+
+		if (epoch_reclamation) {
+			epoch_exit(tinfo->thread_num);
+		}
+
+		op_end(tinfo, work.op_type, start);
 	}
 
-	/*
-	 * Create the initial tree
-	 */
-	std::ifstream create_tree_file(create_file);
-	std::string str;
+	finish_ops(tinfo, ops);
 
-	tree_values_correctness.clear();
-	while (std::getline(create_tree_file, str)) {
-		std::string value = str.substr(str.find(' '));
-		int val = std::stoi(value);
-		
-		if(perform_FG_test) {
-			//perform insertion into fine-grained tree
-			insert(val, g_root, NULL, -1);
+	return 0;
+}
+
+void *perform_ops_EXT(void *thread_args)
+{
+	WORK work;
+	int work_value;
+	unsigned long ops = 0;
+	uint64_t start;
+	struct thread_info *tinfo = (struct thread_info *)thread_args;
+	EXT_Thread_Ctx *ctx = get_EXT_thread_ctx(tinfo->thread_num);
+
+	start_ops(tinfo);
+
+	while (get_work(tinfo, &work, &ops)) {
+		work_value = work.value;
+		ops++;
+		start = op_begin(&work);
+
+		if (epoch_reclamation) {
+			epoch_enter(tinfo->thread_num);
 		}
-		else {
-			//perform insertion into lock-free tree
-			add(val, 0);
+
+		if (work.op_type == INSERT) {
+			external_insert(work_value, ctx);
+		} else if (work.op_type == SEARCH) {
+			external_contains(work_value, ctx);
+		} else if (work.op_type == DELETE) {
+			external_remove(work_value, ctx);
 		}
 
-		/*
-		 * If performing correctness test, also add this value to the vector
-		 */
-		if (perform_correctness == 1) {
-			tree_values_correctness.push_back(val);
+		if (epoch_reclamation) {
+			epoch_exit(tinfo->thread_num);
 		}
+
+		op_end(tinfo, work.op_type, start);
 	}
-	create_tree_file.close();
 
-	/*
-	 * Read from the tracefile and fill-up the work queue
-	 */
-	wq = new WorkQueue<WORK>;
-	if (wq == NULL) {
-		printf("Cannot allocate memory\n");
-		return -ENOMEM;
+	finish_ops(tinfo, ops);
+
+	return 0;
+}
+
+/*
+ * Drain the dispatcher without touching a tree, to measure what handing out
+ * the operations costs on its own
+ */
+void *perform_ops_dispatch(void *thread_args)
+{
+	WORK work;
+	uintptr_t sum = 0;
+	unsigned long ops = 0;
+	struct thread_info *tinfo = (struct thread_info *)thread_args;
+
+	start_ops(tinfo);
+
+	while (get_trace_work(tinfo, &work)) {
+		sum += work.value + work.op_type;
+		ops++;
 	}
 
-	WORK w;
-	std::ifstream tracefile(test_file);
-	while (std::getline(tracefile, str)) {
-		std::string operation = str.substr(0, str.find(' '));
-		std::string value = str.substr(str.find(' '));
-		int val = std::stoi(value);
+	finish_ops(tinfo, ops);
 
-		if (operation.compare("insert") == 0) {
-			w.op_type = INSERT;
-		} else if (operation.compare("search") == 0) {
-			w.op_type = SEARCH;
-		} else if (operation.compare("delete") == 0) {
-			w.op_type = DELETE;
-			/*
-			 * If performing correctness test then remove the element from the vector too
-			 */
-			if (perform_correctness == 1) {
-				tree_values_correctness.erase(std::find(tree_values_correctness.begin(),
-									tree_values_correctness.end(),
-									val));
+	// Returned so the loop can't be optimized away
+	return (void *)sum;
+}
+
+static void sleep_seconds(double seconds)
+{
+	struct timespec delay;
+
+	delay.tv_sec = (time_t)seconds;
+	delay.tv_nsec = (long)((seconds - delay.tv_sec) * 1e9);
+	while (nanosleep(&delay, &delay) != 0 && errno == EINTR);
+}
+
+/*
+ * Keys to prefill the tree with for a generated workload. With inserts and
+ * deletes of uniformly random keys, any one key is in the tree
+ * insert / (insert + delete) of the time, so the tree starts out at the size
+ * it would settle at anyway. Read-only mixes get half the range. The keys
+ * come out sorted, which bulk loading wants, and are shuffled for inserting
+ * them one at a time.
+ */
+static void prefill_keys(std::vector<int> &keys)
+{
+	uint64_t inserts = op_mix[INSERT], updates = op_mix[INSERT] + op_mix[DELETE];
+	Rand_State r;
+
+	if (updates == 0) {
+		inserts = 1;
+		updates = 2;
+	}
+
+	// Its own stream, apart from any worker's
+	rand_seed(&r, op_seed + MAX_THREADS);
+	keys.clear();
+	for (int key = 0; key < key_range; key++) {
+		if (rand_below(&r, updates) < inserts) {
+			keys.push_back(key);
+		}
+	}
+
+	if (serial_create) {
+		for (size_t i = keys.size(); i > 1; i--) {
+			std::swap(keys[i - 1], keys[rand_below(&r, i)]);
+		}
+	}
+}
+
+/*
+ * Start from a fresh tree holding keys, and return how long building it
+ * took. keys is a copy, because bulk loading sorts and dedupes it. In a
+ * sweep every run gets a tree of its own; the one the run before left
+ * behind is abandoned, not freed.
+ */
+static double build_tree(std::vector<int> keys)
+{
+	double start_time;
+
+	if(tree_type == FG_TREE) {
+		//Initialize the sentinel root for fine-grained tree
+		g_root = createNode(FG_SENTINEL_VALUE, NULL);
+	}
+	else if (tree_type == LF_TREE) {
+		//Intialize auxiliary/base root for lock-free tree
+		base_root = create_LF_node(-1, get_LF_thread_ctx(0));
+	}
+	else if (tree_type == CHROMATIC_TREE) {
+		//Initialize the sentinels of the chromatic tree
+		chromatic_init();
+	}
+	else {
+		//Initialize the sentinels of the external tree
+		external_init();
+	}
+
+	start_time = timer_seconds();
+	if (serial_create) {
+		/*
+		 * Insert the keys one at a time, in file order. Sorted files
+		 * give a degenerate tree.
+		 */
+		for (size_t i = 0; i < keys.size(); i++) {
+			if(tree_type == FG_TREE) {
+				//perform insertion into fine-grained tree
+				insert(keys[i], g_root, NULL, -1);
+			}
+			else if (tree_type == LF_TREE) {
+				//perform insertion into lock-free tree
+				add(keys[i], get_LF_thread_ctx(0));
 			}
+			else if (tree_type == CHROMATIC_TREE) {
+				chromatic_insert(keys[i], get_CT_thread_ctx(0));
+			}
+			else {
+				external_insert(keys[i], get_EXT_thread_ctx(0));
+			}
+		}
+	} else {
+		// Sorts and dedupes keys, and builds a balanced tree
+		if(tree_type == FG_TREE) {
+			bulk_load_FG(keys, num_threads);
 		}
+		else if (tree_type == LF_TREE) {
+			bulk_load_LF(keys, num_threads);
+		}
+		else {
+			bulk_load_external(keys);
+		}
+	}
 
-		w.value = val;
-		wq->put_work(w);
+	return timer_seconds() - start_time;
+}
+
+/*
+ * Run the whole trace on num_threads workers, placed as pin_policy says,
+ * and return how long the measured phase took in *run_time
+ */
+static int run_workers(struct thread_info *tinfo, double *run_time)
+{
+	int thread_count = 0, ret;
+	pthread_attr_t attr;
+	cpu_set_t cpu_set;
+	std::vector<int> cpus;
+	double start_time;
+
+	ret = pin_plan(pin_policy, num_threads, cpus);
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (!cpus.empty() && sweep_threads.empty()) {
+		printf("Pinned %d threads %s, to CPUs", num_threads, pin_policy_name(pin_policy));
+		for (size_t i = 0; i < cpus.size(); i++) {
+			printf(" %d", cpus[i]);
+		}
+		printf("\n");
 	}
-	tracefile.close();
 
 	/*
 	 * Create and start the threads
@@ -202,33 +706,59 @@ int init_harness(void)
 		return -errno;
 	}
 
-	tinfo = (struct thread_info *)calloc(MAX_THREADS, sizeof(struct thread_info));
-	if (tinfo == NULL) {
-		printf("calloc failed\n");
-		return -errno;
-	}
+	memset(tinfo, 0, num_threads * sizeof(struct thread_info));
+	work_dispatch.reset_stats();
+	work_dispatch.keep_order(perform_correctness != 0);
+	work_dispatch.seal(num_threads, 0, phase_end(0));
+	bench_phase.store(PHASE_WARMUP, std::memory_order_relaxed);
 
-	while (thread_count < MAX_THREADS) {
+	pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+	pthread_barrier_init(&phase_barrier, NULL, num_threads);
+	while (thread_count < num_threads) {
 		tinfo[thread_count].thread_num = thread_count;
-		hp_off[thread_count] = thread_count * NUM_HP_PER_THREAD;
 
-		if(perform_FG_test) {
+		if (!cpus.empty()) {
+			CPU_ZERO(&cpu_set);
+			CPU_SET(cpus[thread_count], &cpu_set);
+			pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+		}
+
+		if (dispatch_only) {
+			ret = pthread_create(&tinfo[thread_count].thread_id, &attr, perform_ops_dispatch, &tinfo[thread_count]);
+		}
+		else if(tree_type == FG_TREE) {
 			ret = pthread_create(&tinfo[thread_count].thread_id, &attr, perform_ops_FG, &tinfo[thread_count]);
 		}
-		else {			
+		else if (tree_type == LF_TREE) {
 			ret = pthread_create(&tinfo[thread_count].thread_id, &attr, perform_ops_LF, &tinfo[thread_count]);
 		}
+		else if (tree_type == CHROMATIC_TREE) {
+			ret = pthread_create(&tinfo[thread_count].thread_id, &attr, perform_ops_CT, &tinfo[thread_count]);
+		}
+		else {
+			ret = pthread_create(&tinfo[thread_count].thread_id, &attr, perform_ops_EXT, &tinfo[thread_count]);
+		}
 		if (ret != 0) {
 			printf("pthread_create failed\n");
 			return -errno;
 		}
 		thread_count++;
 	}
-	all_threads_created = true;
-
 	ret = pthread_attr_destroy(&attr);
+
+	// Let them go
+	schedule_start = timer_ticks();
+	pthread_barrier_wait(&start_barrier);
+
+	if (duration > 0) {
+		sleep_seconds(warmup);
+		bench_phase.store(PHASE_MEASURE, std::memory_order_relaxed);
+		sleep_seconds(duration);
+		bench_phase.store(PHASE_STOP, std::memory_order_relaxed);
+	}
+
 	thread_count = 0;
-	while (thread_count < MAX_THREADS) {
+	while (thread_count < num_threads) {
 		ret = pthread_join(tinfo[thread_count].thread_id, NULL);
 		if (ret != 0) {
 			printf("pthread_join failed\n");
@@ -236,72 +766,789 @@ int init_harness(void)
 
 		thread_count++;
 	}
+	pthread_barrier_destroy(&start_barrier);
+	pthread_barrier_destroy(&phase_barrier);
+
+	/*
+	 * The measured phase runs from the first worker starting to the last
+	 * one finishing. The main thread's own clock could start late, if it
+	 * isn't scheduled right after the barrier.
+	 */
+	start_time = tinfo[0].start_time;
+	*run_time = tinfo[0].end_time;
+	for (thread_count = 1; thread_count < num_threads; thread_count++) {
+		start_time = std::min(start_time, tinfo[thread_count].start_time);
+		*run_time = std::max(*run_time, tinfo[thread_count].end_time);
+	}
+
+	trace_phases.front().start_time = start_time;
+	end_phase(trace_phases.size() - 1, *run_time);
+	*run_time -= start_time;
+
+	// Taking stock between phases isn't part of the run
+	for (size_t p = 1; p < trace_phases.size(); p++) {
+		*run_time -= trace_phases[p].start_time - trace_phases[p - 1].end_time;
+	}
+
+	return 0;
+}
+
+static void check_valid_tree(void)
+{
+	if(tree_type == FG_TREE) {
+		//print_FG_Tree(g_root);
+		check_valid_FG_Tree();
+	}
+	else if (tree_type == LF_TREE) {
+		//print_LF_Tree(base_root);
+		check_valid_LF_Tree();
+	}
+	else if (tree_type == CHROMATIC_TREE) {
+		check_valid_CT_Tree();
+	}
+	else {
+		check_valid_EXT_Tree();
+	}
+}
+
+/*
+ * --sweep and --rate-sweep: the same workload once per thread count and
+ * offered load, each time on a freshly built tree, with one CSV row per
+ * run. Offered loads go from low to high, up to the first one the tree
+ * can't keep up with.
+ */
+static int run_sweep(std::vector<int> &create_values, struct thread_info *tinfo)
+{
+	std::vector<int> threads = sweep_threads;
+	std::vector<double> rates = sweep_rates;
+	double build_time, run_time;
+	unsigned long ops;
+	int ret;
+
+	if (threads.empty()) {
+		threads.push_back(num_threads);
+	}
+	if (rates.empty()) {
+		rates.push_back(offered_rate);
+	}
+	std::sort(rates.begin(), rates.end());
+
+	print_csv_header();
+	for (size_t i = 0; i < threads.size(); i++) {
+		for (size_t j = 0; j < rates.size(); j++) {
+			num_threads = threads[i];
+			offered_rate = rates[j];
+			build_time = build_tree(create_values);
+
+			ret = run_workers(tinfo, &run_time);
+			if (ret != 0) {
+				return ret;
+			}
+
+			if (epoch_reclamation) {
+				for (int thread_count = 0; thread_count < num_threads; thread_count++) {
+					epoch_drain(thread_count);
+				}
+			}
+			if (perform_correctness != 0 && !dispatch_only) {
+				check_valid_tree();
+			}
+
+			print_csv_row(tinfo, create_values.size(), build_time, run_time);
+			// A long sweep shows its rows as they come
+			fflush(stdout);
+
+			ops = 0;
+			for (int thread_count = 0; thread_count < num_threads; thread_count++) {
+				ops += tinfo[thread_count].ops;
+			}
+			if (offered_rate > 0 && ops < RATE_SWEEP_SATURATION * offered_rate * run_time) {
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The keys of the initial tree: the values of the create file's
+ * operations, whichever format it is in
+ */
+static int load_keys(std::vector<int> &keys)
+{
+	Trace_Map map;
+	std::string str;
+	int ret;
+
+	if (trace_is_binary(create_file)) {
+		ret = trace_map(&map, create_file);
+		if (ret != 0) {
+			fprintf(stderr, "Could not map %s: %s\n", create_file, strerror(-ret));
+			return ret;
+		}
+		for (uint64_t i = 0; i < map.header->num_records; i++) {
+			keys.push_back(map.records[i].value);
+		}
+		trace_unmap(&map);
+		return 0;
+	}
+
+	std::ifstream create_tree_file(create_file);
+
+	while (std::getline(create_tree_file, str)) {
+		std::string value = str.substr(str.find(' '));
+		keys.push_back(std::stoi(value));
+	}
+	create_tree_file.close();
+	return 0;
+}
+
+/*
+ * --correctness=1: a deleted key shouldn't be in the tree at the end
+ */
+static void forget_deleted_key(int val)
+{
+	std::vector<int>::iterator it = std::find(tree_values_correctness.begin(),
+						  tree_values_correctness.end(), val);
+
+	// Expiring a range deletes keys that may never have been inserted
+	if (it != tree_values_correctness.end()) {
+		tree_values_correctness.erase(it);
+	}
+}
+
+/*
+ * Parse a text trace into the dispatcher. A line may have a third column,
+ * the operation's arrival time in microseconds from the start of the
+ * trace, for --replay-timing. "phase <n>" lines start a new phase.
+ * Like traceconv, gives up on the first line that is not an operation.
+ */
+static int load_text_trace(size_t *timestamps)
+{
+	WORK w;
+	Phase_Stats phase;
+	std::string str;
+	std::ifstream tracefile(test_file);
+	unsigned long line_num = 0;
+
+	memset(&w, 0, sizeof(w));
+	memset(&phase, 0, sizeof(phase));
+	while (std::getline(tracefile, str)) {
+		line_num++;
+		if (str.find(' ') == std::string::npos) {
+			fprintf(stderr, "%s:%lu: not an operation\n", test_file, line_num);
+			return -EINVAL;
+		}
+
+		std::string operation = str.substr(0, str.find(' '));
+		std::string value = str.substr(str.find(' '));
+		size_t arrival = str.find(' ', str.find_first_not_of(' ', str.find(' ')));
+		int val = std::stoi(value);
+
+		if (operation.compare("phase") == 0) {
+			// A marker on the first line just names the first phase
+			if (work_dispatch.size() > trace_phases.back().start) {
+				phase.start = work_dispatch.size();
+				trace_phases.push_back(phase);
+			}
+			continue;
+		}
+
+		w.arrival = 0;
+		if (arrival != std::string::npos && str.find_first_not_of(' ', arrival) != std::string::npos) {
+			w.arrival = (uint64_t)(std::stod(str.substr(arrival)) * 1000);
+			(*timestamps)++;
+		}
+
+		if (operation.compare("insert") == 0) {
+			w.op_type = INSERT;
+		} else if (operation.compare("search") == 0) {
+			w.op_type = SEARCH;
+		} else if (operation.compare("delete") == 0) {
+			w.op_type = DELETE;
+			/*
+			 * If performing correctness test then remove the element from the vector too
+			 */
+			if (perform_correctness == 1) {
+				forget_deleted_key(val);
+			}
+		} else {
+			fprintf(stderr, "%s:%lu: unknown operation %s\n", test_file, line_num, operation.c_str());
+			return -EINVAL;
+		}
+
+		w.value = val;
+		trace_phases.back().ops[w.op_type]++;
+		work_dispatch.put_work(w);
+	}
+	tracefile.close();
+	return 0;
+}
+
+/*
+ * Map a binary trace and let the dispatcher deal its records out where
+ * they lie. Only --correctness=1 needs to look at them up front.
+ */
+static int load_binary_trace(size_t *timestamps)
+{
+	const Trace_Header *header;
+	Phase_Stats phase;
+	int ret;
+
+	ret = trace_map(&test_trace, test_file);
+	if (ret != 0) {
+		fprintf(stderr, "Could not map %s: %s\n", test_file, strerror(-ret));
+		return ret;
+	}
+
+	header = test_trace.header;
+
+	/*
+	 * trace_map() only checks the header and the phase table. The workers
+	 * index per-operation tables with op_type, so check every record once
+	 * here rather than on the hot path.
+	 */
+	for (uint64_t i = 0; i < header->num_records; i++) {
+		int op_type = test_trace.records[i].op_type;
+
+		if (op_type < 0 || op_type >= NUM_OP_TYPES) {
+			fprintf(stderr, "%s: record %lu has no operation %d\n", test_file, (unsigned long)i,
+				op_type);
+			trace_unmap(&test_trace);
+			return -EINVAL;
+		}
+	}
+
+	work_dispatch.attach(test_trace.records, header->num_records);
+
+	memset(&phase, 0, sizeof(phase));
+	trace_phases.clear();
+	for (uint64_t i = 0; i < header->num_phases; i++) {
+		phase.start = test_trace.phases[i].start;
+		for (int op = 0; op < NUM_OP_TYPES; op++) {
+			phase.ops[op] = test_trace.phases[i].ops[op];
+		}
+		trace_phases.push_back(phase);
+	}
+
+	*timestamps = (header->flags & TRACE_HAS_ARRIVALS) ? header->num_records : 0;
+
+	for (uint64_t i = 0; perform_correctness == 1 && i < header->num_records; i++) {
+		if (test_trace.records[i].op_type == DELETE) {
+			forget_deleted_key(test_trace.records[i].value);
+		}
+	}
+	return 0;
+}
+
+int init_harness(void)
+{
+	int thread_count, ret;
+	struct thread_info *tinfo;
+	std::vector<int> create_values;
+	double build_time, run_time;
+
+	timer_init();
+
+	/*
+	 * The chromatic tree balances itself, so it is always built by
+	 * inserting the keys
+	 */
+	if (tree_type == CHROMATIC_TREE) {
+		serial_create = true;
+	}
+
+	/*
+	 * Read the keys of the initial tree, or make them up for a generated
+	 * workload that wasn't given any
+	 */
+	if (duration > 0 && create_file[0] == '\0') {
+		prefill_keys(create_values);
+		strcpy(create_file, "prefill");
+	} else {
+		ret = load_keys(create_values);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	/*
+	 * If performing correctness test, also add the values to the vector
+	 */
+	tree_values_correctness.clear();
+	if (perform_correctness == 1) {
+		tree_values_correctness = create_values;
+	}
+
+	if (duration > 0) {
+		// Stands in for the trace name in the summary
+		snprintf(test_file, sizeof(test_file), "generated:%d/%d/%d:%d",
+			 op_mix[INSERT], op_mix[SEARCH], op_mix[DELETE], key_range);
+		if (sweep_threads.empty()) {
+			printf("Generating operations for %.3f s after %.3f s of warmup: %d%% insert, "
+			       "%d%% search, %d%% delete, keys 0 to %d, seed %lu\n", duration, warmup,
+			       op_mix[INSERT], op_mix[SEARCH], op_mix[DELETE], key_range - 1, op_seed);
+		}
+	}
+
+	/*
+	 * Hand the trace to the dispatcher
+	 */
+	Phase_Stats phase;
+	size_t timestamps = 0;
+	double load_time = timer_seconds();
+
+	memset(&phase, 0, sizeof(phase));
+	trace_phases.assign(1, phase);
+	if (duration == 0 && trace_is_binary(test_file)) {
+		ret = load_binary_trace(&timestamps);
+		if (ret != 0) {
+			return ret;
+		}
+	} else if (duration == 0) {
+		ret = load_text_trace(&timestamps);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	load_time = timer_seconds() - load_time;
+	if (duration == 0 && sweep_threads.empty() && sweep_rates.empty()) {
+		printf("Loaded %zu operations in %.3f s (%s trace)\n", work_dispatch.size(), load_time,
+		       test_trace.base != NULL ? "binary" : "text");
+	}
+
+	if (arrivals == ARRIVALS_TRACE && timestamps != work_dispatch.size()) {
+		fprintf(stderr, "--replay-timing needs an arrival time on every line of %s\n", test_file);
+		return -EINVAL;
+	}
+
+	tinfo = (struct thread_info *)calloc(MAX_THREADS, sizeof(struct thread_info));
+	if (tinfo == NULL) {
+		printf("calloc failed\n");
+		return -errno;
+	}
+
+	if (!sweep_threads.empty() || !sweep_rates.empty()) {
+		ret = run_sweep(create_values, tinfo);
+		free(tinfo);
+		return ret;
+	}
+
+	build_time = build_tree(create_values);
+	printf("Created the initial tree with %zu keys in %.3f s%s\n", create_values.size(),
+	       build_time, serial_create ? " (serial)" : "");
+
+	ret = run_workers(tinfo, &run_time);
+	if (ret != 0) {
+		free(tinfo);
+		return ret;
+	}
+
+	print_throughput(tinfo, run_time);
+	print_phases();
+	if (arrivals == ARRIVALS_TRACE) {
+		printf("Open loop: arrival times replayed from the trace\n");
+	} else if (arrivals != ARRIVALS_CLOSED) {
+		printf("Open loop: %s arrivals, %.0f ops/s offered\n", arrival_names[arrivals], offered_rate);
+	}
+	if (record_latency) {
+		print_latency();
+	}
+	if (duration == 0) {
+		work_dispatch.print_stats();
+	}
+	if (dispatch_only) {
+		printf("Dispatch only: %.1f ns per operation\n",
+		       work_dispatch.size() ? run_time * 1e9 / work_dispatch.size() : 0.0);
+		print_summary(tinfo, create_values.size(), build_time, run_time);
+		free(tinfo);
+		return 0;
+	}
+
+	print_peak_rss();
+	if (tree_type == FG_TREE) {
+		print_FG_stats();
+	} else if (tree_type == LF_TREE) {
+		print_LF_stats();
+		slab_print_stats();
+	} else if (tree_type == CHROMATIC_TREE) {
+		print_CT_stats();
+		slab_print_stats();
+	} else if (tree_type == EXTERNAL_TREE) {
+		print_EXT_stats();
+		slab_print_stats();
+	}
+	if (epoch_reclamation) {
+		epoch_print_stats();
+		for (thread_count = 0; thread_count < num_threads; thread_count++) {
+			epoch_drain(thread_count);
+		}
+	}
+
+	if (perform_correctness != 0) {
+		check_valid_tree();
+	}
+
+	print_summary(tinfo, create_values.size(), build_time, run_time);
+	free(tinfo);
+
+	return 0;
+}
+
+static void print_usage(void)
+{
+	fprintf(stderr, "Usage: test {--create-file=<tree_creation_file_name> --test-file=<trace_file_name> | "
+		"--duration=<seconds> [--warmup=<seconds>] [--mix=<insert>,<search>,<delete>] [--key-range=<n>] "
+		"[--seed=<n>] [--create-file=<tree_creation_file_name>]} "
+		"[--lock-free [--hazard-pointers | --epoch] | --chromatic [--epoch] | --external [--epoch]] "
+		"[--optimistic | --rw-locks] [--huge-pages] [--serial-create] [--dispatch-only] [--latency] "
+		"[--threads=<n> | --sweep=<n>,<n>,...] [--pin=compact|scatter|smt-off] "
+		"[{--rate=<ops/s> | --rate-sweep=<ops/s>,<ops/s>,...} [--arrivals=poisson|fixed] | --replay-timing]\n"
+		"  --rw-locks needs node locks with a shared mode. This build has %s locks%s; "
+		"make FG_LOCK=Pthread_RW_Lock or FG_LOCK=TATAS_RW_Lock builds one with them.\n",
+		FG_LOCK_POLICY::name(), FG_LOCK_POLICY::has_shared() ? "" : ", which have none");
+}
+
+/*
+ * Percentages of inserts, searches and deletes for --mix, e.g. "10,80,10"
+ */
+static int parse_mix(const char *list)
+{
+	int sum = 0;
+
+	if (sscanf(list, "%d,%d,%d", &op_mix[INSERT], &op_mix[SEARCH], &op_mix[DELETE]) != 3) {
+		return -EINVAL;
+	}
+
+	for (int op = 0; op < NUM_OP_TYPES; op++) {
+		if (op_mix[op] < 0) {
+			return -EINVAL;
+		}
+		sum += op_mix[op];
+	}
+	return sum == 100 ? 0 : -EINVAL;
+}
+
+/*
+ * Offered loads for --rate-sweep, e.g. "100000,200000,400000"
+ */
+static int parse_rates(const char *list)
+{
+	const char *pos = list;
+	char *end;
+	double rate;
+
+	sweep_rates.clear();
+	while (true) {
+		rate = strtod(pos, &end);
+		if (end == pos || !(rate > 0)) {
+			return -EINVAL;
+		}
+		sweep_rates.push_back(rate);
+
+		if (*end == '\0') {
+			return 0;
+		}
+		if (*end != ',') {
+			return -EINVAL;
+		}
+		pos = end + 1;
+	}
+}
+
+/*
+ * Thread counts for --sweep, e.g. "1,2,4,8"
+ */
+static int parse_sweep(const char *list)
+{
+	const char *pos = list;
+	char *end;
+	long threads;
+
+	sweep_threads.clear();
+	while (true) {
+		threads = strtol(pos, &end, 10);
+		if (end == pos || threads < 1 || threads > MAX_THREADS) {
+			return -EINVAL;
+		}
+		sweep_threads.push_back(threads);
+
+		if (*end == '\0') {
+			return 0;
+		}
+		if (*end != ',') {
+			return -EINVAL;
+		}
+		pos = end + 1;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int idx = 0, c;
+	int arrival_pattern = ARRIVALS_POISSON;
+	bool replay_timing = false;
+	std::vector<int> cpus;
+
+	if(argc < 2) {
+		print_usage();
+		return -EINVAL;
+	}
+
+	/*
+	 * Fine grained is true by default. Can be over-ridden by passing in a 
+	 * command line parameter.
+	 */
+	tree_type = FG_TREE;
+	while (true) {
+		c = getopt_long(argc, argv, "c:t:l", long_options, &idx);
+
+		if (-1 == c) {
+			// End of options
+			break;
+		}
+
+		switch (c) {
+			case 'c':
+				strcpy(create_file, optarg);
+				break;
+
+			case 't':
+				strcpy(test_file, optarg);
+				break;
+
+			case 'l':
+				tree_type = LF_TREE;
+				break;
+
+			case 'r':
+				tree_type = CHROMATIC_TREE;
+				break;
+
+			case 'x':
+				tree_type = EXTERNAL_TREE;
+				break;
+
+			case 'o':
+				perform_correctness = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'h':
+				hazard_pointers = true;
+				break;
+
+			case 'e':
+				epoch_reclamation = true;
+				break;
+
+			case 'g':
+				huge_pages = true;
+				break;
+
+			case 's':
+				serial_create = true;
+				break;
+
+			case 'p':
+				optimistic_reads = true;
+				break;
+
+			case 'w':
+				rw_locks = true;
+				break;
+
+			case 'd':
+				dispatch_only = true;
+				break;
+
+			case 'y':
+				record_latency = true;
+				break;
+
+			case 'n':
+				num_threads = atoi(optarg);
+				if (num_threads < 1 || num_threads > MAX_THREADS) {
+					fprintf(stderr, "--threads must be between 1 and %d\n", MAX_THREADS);
+					return -EINVAL;
+				}
+				break;
+
+			case 'a':
+				pin_policy = pin_policy_parse(optarg);
+				if (pin_policy < 0) {
+					fprintf(stderr, "--pin must be one of compact, scatter and smt-off\n");
+					return -EINVAL;
+				}
+				break;
+
+			case 'S':
+				if (parse_sweep(optarg) != 0) {
+					fprintf(stderr, "--sweep takes a comma separated list of thread counts, "
+						"each between 1 and %d\n", MAX_THREADS);
+					return -EINVAL;
+				}
+				break;
+
+			case 'D':
+				duration = atof(optarg);
+				if (duration <= 0) {
+					fprintf(stderr, "--duration must be more than 0 seconds\n");
+					return -EINVAL;
+				}
+				break;
+
+			case 'W':
+				warmup = atof(optarg);
+				if (warmup < 0) {
+					fprintf(stderr, "--warmup can't be negative\n");
+					return -EINVAL;
+				}
+				break;
+
+			case 'm':
+				if (parse_mix(optarg) != 0) {
+					fprintf(stderr, "--mix takes insert, search and delete percentages "
+						"that add up to 100, e.g. 10,80,10\n");
+					return -EINVAL;
+				}
+				break;
+
+			case 'k':
+				key_range = atoi(optarg);
+				if (key_range < 1 || key_range > MAX_KEY_RANGE) {
+					fprintf(stderr, "--key-range must be between 1 and %d\n", MAX_KEY_RANGE);
+					return -EINVAL;
+				}
+				break;
+
+			case 'E':
+				op_seed = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'R':
+				offered_rate = atof(optarg);
+				if (offered_rate <= 0) {
+					fprintf(stderr, "--rate must be more than 0 operations per second\n");
+					return -EINVAL;
+				}
+				break;
+
+			case 'A':
+				if (strcmp(optarg, "poisson") == 0) {
+					arrival_pattern = ARRIVALS_POISSON;
+				} else if (strcmp(optarg, "fixed") == 0) {
+					arrival_pattern = ARRIVALS_FIXED;
+				} else {
+					fprintf(stderr, "--arrivals must be poisson or fixed\n");
+					return -EINVAL;
+				}
+				break;
+
+			case 'L':
+				if (parse_rates(optarg) != 0) {
+					fprintf(stderr, "--rate-sweep takes a comma separated list of operations "
+						"per second, each more than 0\n");
+					return -EINVAL;
+				}
+				break;
+
+			case 'T':
+				replay_timing = true;
+				break;
+		}
+	}
+
+	if (duration > 0) {
+		if (test_file[0] != '\0') {
+			fprintf(stderr, "--duration generates its operations, it can't also replay --test-file\n");
+			return -EINVAL;
+		}
+		if (dispatch_only) {
+			fprintf(stderr, "--dispatch-only needs a --test-file to dispatch\n");
+			return -EINVAL;
+		}
+		if (perform_correctness == 1) {
+			// Nobody knows which keys should be left; --correctness=2 checks the structure
+			fprintf(stderr, "--correctness=1 needs a --test-file\n");
+			return -EINVAL;
+		}
+	} else if (test_file[0] == '\0') {
+		print_usage();
+		return -EINVAL;
+	}
 
-	free(tinfo);
-	free(wq);
-
-	if (perform_correctness != 0) {
-		if(perform_FG_test) {
-			//print_FG_Tree(g_root);
-			check_valid_FG_Tree();
+	if (replay_timing) {
+		if (duration > 0) {
+			fprintf(stderr, "--replay-timing needs a --test-file with arrival times\n");
+			return -EINVAL;
 		}
-		else {
-			//print_LF_Tree(base_root);
-			check_valid_LF_Tree();
+		if (offered_rate > 0 || !sweep_rates.empty()) {
+			fprintf(stderr, "--replay-timing takes its rate from the trace, not --rate or --rate-sweep\n");
+			return -EINVAL;
 		}
+		arrivals = ARRIVALS_TRACE;
+	} else if (offered_rate > 0 || !sweep_rates.empty()) {
+		arrivals = arrival_pattern;
 	}
 
-	return 0;
-}
-
-int main(int argc, char **argv)
-{
-	int idx = 0, c;
+	if (arrivals != ARRIVALS_CLOSED) {
+		if (dispatch_only) {
+			fprintf(stderr, "--dispatch-only runs closed loop\n");
+			return -EINVAL;
+		}
+		// Latency is the point of running open loop
+		record_latency = true;
+	}
 
-	if(argc < 3) {
-		fprintf(stderr, "Usage: test --create-file=<tree_creation_file_name> --test-file=<trace_file_name> --lock-free --hazard-pointers\n");
+	if (hazard_pointers && epoch_reclamation) {
+		fprintf(stderr, "--hazard-pointers and --epoch are mutually exclusive\n");
 		return -EINVAL;
 	}
 
-	/*
-	 * Fine grained is true by default. Can be over-ridden by passing in a 
-	 * command line parameter.
-	 */
-	perform_FG_test = true;
-	while (true) {
-		c = getopt_long(argc, argv, "c:t:l", long_options, &idx);
+	if (hazard_pointers && (tree_type == CHROMATIC_TREE || tree_type == EXTERNAL_TREE)) {
+		fprintf(stderr, "--hazard-pointers is only supported by the lock-free tree\n");
+		return -EINVAL;
+	}
 
-		if (-1 == c) {
-			// End of options
-			break;
+	if (optimistic_reads) {
+		if (tree_type != FG_TREE) {
+			fprintf(stderr, "--optimistic only applies to the fine-grained tree\n");
+			return -EINVAL;
 		}
+		// Nodes removed under optimistic readers are freed a grace period later
+		epoch_reclamation = true;
+	}
 
-		switch (c) {
-			case 'c':
-				strcpy(create_file, optarg);
-				break;
-
-			case 't':
-				strcpy(test_file, optarg);
-				break;
-
-			case 'l':
-				perform_FG_test = false;
-				break;
-
-			case 'o':
-				perform_correctness = strtoul(optarg, NULL, 10);
-				break;
-
-			case 'h':
-				hazard_pointers = true;
-				break;
+	if (rw_locks) {
+		if (tree_type != FG_TREE) {
+			fprintf(stderr, "--rw-locks only applies to the fine-grained tree\n");
+			return -EINVAL;
+		}
+		if (optimistic_reads) {
+			fprintf(stderr, "--optimistic and --rw-locks are mutually exclusive\n");
+			return -EINVAL;
+		}
+		if (!FG_LOCK_POLICY::has_shared()) {
+			fprintf(stderr, "--rw-locks needs node locks with a shared mode, %s locks have none; "
+				"rebuild with make clean; make FG_LOCK=Pthread_RW_Lock (or TATAS_RW_Lock)\n",
+				FG_LOCK_POLICY::name());
+			return -EINVAL;
 		}
 	}
 
-	init_harness();
+	/*
+	 * Check the placement up front, rather than halfway through a sweep
+	 */
+	if (!sweep_threads.empty()) {
+		num_threads = *std::max_element(sweep_threads.begin(), sweep_threads.end());
+	}
+	if (pin_plan(pin_policy, num_threads, cpus) != 0) {
+		return -EINVAL;
+	}
 
-	return 0;
+	return init_harness();
 }	
 
 void print_FG_Tree(FG_BST_Node* root)
@@ -366,7 +1613,7 @@ void print_LF_Tree(LF_BST_Node* root)
 
 		for(vec_itr = vec.begin(); vec_itr != vec.end(); vec_itr++) {
 			LF_BST_Node *node = *vec_itr;
-			printf("Node:%d, ", node->key);
+			printf("Node:%d, ", node->key.load(std::memory_order_relaxed));
 		}
 		printf("\n");
 	}
@@ -389,8 +1636,8 @@ void add_LF_TreeToMap(LF_BST_Node* root, int level)
 		level_Map_LF[level].push_back(root);		
 	}
 
-	add_LF_TreeToMap(root->left, level+1);
-	add_LF_TreeToMap(root->right, level+1);
+	add_LF_TreeToMap(root->left.load(std::memory_order_relaxed), level+1);
+	add_LF_TreeToMap(root->right.load(std::memory_order_relaxed), level+1);
 	return;
 }
 
@@ -400,7 +1647,9 @@ void check_valid_FG_Tree()
 	std::vector<int>::iterator it;
 	int prev = INT_MIN;
 
-	populate_tree_values_FG(g_root);
+	// Skip the sentinel
+	tree_values_FG.clear();
+	populate_tree_values_FG(g_root->right);
 
 	if (perform_correctness == 1) {
 		if (tree_values_correctness.size() != tree_values_FG.size()) {
@@ -470,6 +1719,7 @@ void check_valid_LF_Tree()
 	std::vector<int>::iterator it;
 	int prev = INT_MIN;
 
+	tree_values_LF.clear();
 	populate_tree_values_LF(base_root);
 
 	if (perform_correctness == 1) {
@@ -527,13 +1777,431 @@ void populate_tree_values_LF(LF_BST_Node *root)
 {
 	int key;
 
-	if(IS_NULL(root) || GET_FLAG(root->op) == MARK)
+	/*
+	 * Only called once the worker threads are joined, so relaxed loads see
+	 * the final tree
+	 */
+	if(IS_NULL(root) || root->op.flag(std::memory_order_relaxed) == MARK)
 		return;
 
-	populate_tree_values_LF(root->left);
-	key = root->key;
+	populate_tree_values_LF(root->left.load(std::memory_order_relaxed));
+	key = root->key.load(std::memory_order_relaxed);
 	tree_values_LF.push_back(key);
 	//printf("Ptr: %p, Left: %p, Val: %d, Right: %p, Flag: %d\n", root, root->left, root->key, root->right,
 	//	GET_FLAG(root->op));
-	populate_tree_values_LF(root->right);
+	populate_tree_values_LF(root->right.load(std::memory_order_relaxed));
+}
+
+void check_valid_CT_Tree()
+{
+	bool valid = true;
+	bool incorrect = false;
+	std::vector<int>::iterator it;
+	int prev = INT_MIN;
+
+	tree_values_CT.clear();
+	populate_tree_values_CT(get_chromatic_root());
+
+	if (perform_correctness == 1) {
+		if (tree_values_correctness.size() != tree_values_CT.size()) {
+			printf("All elements were not correctly deleted\n");
+		} else {
+			printf("Chromatic tree is valid in terms of number of operations performed.\n");
+		}
+	}
+
+	printf("Printing out chromatic tree in-order: ");
+	for(it = tree_values_CT.begin(); it != tree_values_CT.end(); it++) {
+
+		int val = *it;
+		printf("%d, ", val);
+
+		if(val <= prev) {
+			printf("\nTree is not in order!\n");
+			valid = false;
+			break;
+		}
+
+		prev = val;
+
+		/*
+		 * check if it is also present in the correctness vector
+		 */
+		if (perform_correctness == 1) {
+			if (std::find(tree_values_correctness.begin(),
+							 tree_values_correctness.end(),
+							 val) == tree_values_correctness.end()) {
+				printf("Value %d not present in the correctness vector\n", val);
+				incorrect = true;
+			}
+		}
+	}
+
+	if(valid) {
+		printf("\nChromatic tree is valid.\n");
+	}
+	else {
+		printf("\nChromatic tree is NOT VALID!!\n");
+		assert(0);
+	}
+
+	if (incorrect) {
+		printf("Chromatic tree is incorrect!!\n");
+		assert(0);
+	} else {
+		printf("Chromatic tree is correct in terms of the remaining tree elements.\n");
+	}
+}
+
+/*
+ * Keys live in the leaves; the sentinel leaves are skipped
+ */
+void populate_tree_values_CT(CT_Node *root)
+{
+	CT_Node *left = root->left.load(std::memory_order_relaxed);
+
+	if (left == NULL) {
+		if (root->key < CT_INF1)
+			tree_values_CT.push_back(root->key);
+		return;
+	}
+
+	populate_tree_values_CT(left);
+	populate_tree_values_CT(root->right.load(std::memory_order_relaxed));
+}
+
+void check_valid_EXT_Tree()
+{
+	bool valid = true;
+	bool incorrect = false;
+	std::vector<int>::iterator it;
+	int prev = INT_MIN;
+
+	tree_values_EXT.clear();
+	populate_tree_values_EXT(get_external_root());
+
+	if (perform_correctness == 1) {
+		if (tree_values_correctness.size() != tree_values_EXT.size()) {
+			printf("All elements were not correctly deleted\n");
+		} else {
+			printf("External tree is valid in terms of number of operations performed.\n");
+		}
+	}
+
+	printf("Printing out external tree in-order: ");
+	for(it = tree_values_EXT.begin(); it != tree_values_EXT.end(); it++) {
+
+		int val = *it;
+		printf("%d, ", val);
+
+		if(val <= prev) {
+			printf("\nTree is not in order!\n");
+			valid = false;
+			break;
+		}
+
+		prev = val;
+
+		/*
+		 * check if it is also present in the correctness vector
+		 */
+		if (perform_correctness == 1) {
+			if (std::find(tree_values_correctness.begin(),
+							 tree_values_correctness.end(),
+							 val) == tree_values_correctness.end()) {
+				printf("Value %d not present in the correctness vector\n", val);
+				incorrect = true;
+			}
+		}
+	}
+
+	if(valid) {
+		printf("\nExternal tree is valid.\n");
+	}
+	else {
+		printf("\nExternal tree is NOT VALID!!\n");
+		assert(0);
+	}
+
+	if (incorrect) {
+		printf("External tree is incorrect!!\n");
+		assert(0);
+	} else {
+		printf("External tree is correct in terms of the remaining tree elements.\n");
+	}
+}
+
+/*
+ * Keys live in the leaves; the sentinel leaves are skipped
+ */
+void populate_tree_values_EXT(EXT_Node *root)
+{
+	EXT_Node *left = root->left.load(std::memory_order_relaxed);
+
+	if (left == NULL) {
+		if (root->key < EXT_INF0)
+			tree_values_EXT.push_back(root->key);
+		return;
+	}
+
+	populate_tree_values_EXT(left);
+	populate_tree_values_EXT(root->right.load(std::memory_order_relaxed));
+}
+
+/*
+ * Longest path from the root to a leaf, in nodes, not counting the
+ * sentinels above the root of the fine-grained tree. Only for use while no
+ * worker is inside an operation.
+ */
+int tree_height_FG(FG_BST_Node *root)
+{
+	if (root == NULL)
+		return 0;
+
+	return 1 + std::max(tree_height_FG(root->left), tree_height_FG(root->right));
+}
+
+int tree_height_LF(LF_BST_Node *root)
+{
+	if (IS_NULL(root))
+		return 0;
+
+	return 1 + std::max(tree_height_LF(root->left.load(std::memory_order_relaxed)),
+			    tree_height_LF(root->right.load(std::memory_order_relaxed)));
+}
+
+int tree_height_CT(CT_Node *root)
+{
+	if (root == NULL)
+		return 0;
+
+	return 1 + std::max(tree_height_CT(root->left.load(std::memory_order_relaxed)),
+			    tree_height_CT(root->right.load(std::memory_order_relaxed)));
+}
+
+int tree_height_EXT(EXT_Node *root)
+{
+	if (root == NULL)
+		return 0;
+
+	return 1 + std::max(tree_height_EXT(root->left.load(std::memory_order_relaxed)),
+			    tree_height_EXT(root->right.load(std::memory_order_relaxed)));
+}
+
+void print_peak_rss()
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		printf("Peak RSS: %ld KB\n", usage.ru_maxrss);
+	}
+}
+
+void print_throughput(struct thread_info *tinfo, double run_time)
+{
+	unsigned long total = 0;
+	double elapsed;
+
+	for (int i = 0; i < num_threads; i++) {
+		elapsed = tinfo[i].end_time - tinfo[i].start_time;
+		printf("Thread %2d: %lu operations in %.3f s, %.0f ops/s\n", i, tinfo[i].ops, elapsed,
+		       elapsed > 0 ? tinfo[i].ops / elapsed : 0.0);
+		total += tinfo[i].ops;
+	}
+
+	printf("Total: %lu operations in %.3f s, %.0f ops/s\n", total, run_time,
+	       run_time > 0 ? total / run_time : 0.0);
+}
+
+/*
+ * One line per phase, for traces that have more than one. The pauses to
+ * take stock between phases count towards neither phase.
+ */
+void print_phases(void)
+{
+	Phase_Stats *p;
+	unsigned long ops;
+	double elapsed;
+
+	for (size_t i = 0; trace_phases.size() > 1 && i < trace_phases.size(); i++) {
+		p = &trace_phases[i];
+		ops = p->ops[INSERT] + p->ops[SEARCH] + p->ops[DELETE];
+		elapsed = p->end_time - p->start_time;
+
+		printf("Phase %2zu: %lu operations (%lu insert, %lu search, %lu delete) in %.3f s, "
+		       "%.0f ops/s; RSS %ld KB, %lu retired not yet freed", i, ops, p->ops[INSERT],
+		       p->ops[SEARCH], p->ops[DELETE], elapsed, elapsed > 0 ? ops / elapsed : 0.0,
+		       p->rss_kb, p->retired);
+		if (!dispatch_only) {
+			printf(", tree height %d", p->height);
+		}
+		printf("\n");
+	}
+}
+
+static const char *op_names[NUM_OP_TYPES] = {"insert", "search", "delete"};
+
+/*
+ * Everybody's histograms for op_type, merged into total
+ */
+static void merge_latency(Latency_Hist *total, int op_type)
+{
+	latency_hist_reset(total);
+	for (int i = 0; i < num_threads; i++) {
+		latency_hist_merge(total, &op_latency[i][op_type]);
+	}
+}
+
+void print_latency(void)
+{
+	static Latency_Hist total;
+
+	if (timer_use_tsc) {
+		printf("Latency, from a TSC at %.3f GHz", 1.0 / timer_ns_per_tick);
+	} else {
+		printf("Latency, from clock_gettime()");
+	}
+	printf("%s:\n", arrivals != ARRIVALS_CLOSED ? ", counted from each operation's scheduled start" : "");
+
+	for (int op = 0; op < NUM_OP_TYPES; op++) {
+		merge_latency(&total, op);
+		if (total.count == 0) {
+			continue;
+		}
+
+		printf("  %-6s %10lu ops, p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns, max %.0f ns\n",
+		       op_names[op], total.count,
+		       timer_ticks_to_ns(latency_hist_percentile(&total, 50.0)),
+		       timer_ticks_to_ns(latency_hist_percentile(&total, 99.0)),
+		       timer_ticks_to_ns(latency_hist_percentile(&total, 99.9)),
+		       timer_ticks_to_ns(total.max));
+	}
+}
+
+/*
+ * Name of what was measured, for the summary
+ */
+static const char *variant_name(void)
+{
+	if (dispatch_only) {
+		return "dispatch";
+	}
+
+	switch (tree_type) {
+	case FG_TREE:
+		return optimistic_reads ? "fg-optimistic" : (rw_locks ? "fg-rw" : "fg");
+	case LF_TREE:
+		return hazard_pointers ? "lf-hp" : (epoch_reclamation ? "lf-epoch" : "lf");
+	case CHROMATIC_TREE:
+		return epoch_reclamation ? "chromatic-epoch" : "chromatic";
+	default:
+		return epoch_reclamation ? "external-epoch" : "external";
+	}
+}
+
+static const char *fg_lock_name(void)
+{
+	return (tree_type == FG_TREE && !dispatch_only) ? FG_LOCK_POLICY::name() : "none";
+}
+
+/*
+ * One line for the whole run and one per thread, as key=value pairs, so
+ * that scripts can grep for "^SUMMARY" and split on spaces. Times are in
+ * seconds, latencies (with --latency, one line per operation type) in ns.
+ */
+void print_summary(struct thread_info *tinfo, size_t keys, double build_time, double run_time)
+{
+	unsigned long total = 0;
+	double elapsed;
+
+	for (int i = 0; i < num_threads; i++) {
+		total += tinfo[i].ops;
+	}
+
+	printf("SUMMARY variant=%s fg_lock=%s threads=%d pin=%s arrivals=%s offered_rate=%.1f "
+	       "create_file=%s test_file=%s keys=%zu "
+	       "build_time=%.6f ops=%lu run_time=%.6f ops_per_sec=%.1f\n",
+	       variant_name(), fg_lock_name(), num_threads, pin_policy_name(pin_policy),
+	       arrival_names[arrivals], offered_rate, create_file, test_file, keys,
+	       build_time, total, run_time, run_time > 0 ? total / run_time : 0.0);
+
+	for (int i = 0; i < num_threads; i++) {
+		elapsed = tinfo[i].end_time - tinfo[i].start_time;
+		printf("SUMMARY_THREAD thread=%d ops=%lu run_time=%.6f ops_per_sec=%.1f\n", i,
+		       tinfo[i].ops, elapsed, elapsed > 0 ? tinfo[i].ops / elapsed : 0.0);
+	}
+
+	for (size_t i = 0; trace_phases.size() > 1 && i < trace_phases.size(); i++) {
+		Phase_Stats *p = &trace_phases[i];
+		unsigned long ops = p->ops[INSERT] + p->ops[SEARCH] + p->ops[DELETE];
+
+		elapsed = p->end_time - p->start_time;
+		printf("SUMMARY_PHASE phase=%zu ops=%lu inserts=%lu searches=%lu deletes=%lu run_time=%.6f "
+		       "ops_per_sec=%.1f rss_kb=%ld retired=%lu height=%d\n", i, ops, p->ops[INSERT],
+		       p->ops[SEARCH], p->ops[DELETE], elapsed, elapsed > 0 ? ops / elapsed : 0.0,
+		       p->rss_kb, p->retired, p->height);
+	}
+
+	if (!record_latency) {
+		return;
+	}
+
+	for (int op = 0; op < NUM_OP_TYPES; op++) {
+		static Latency_Hist total;
+
+		merge_latency(&total, op);
+		if (total.count == 0) {
+			continue;
+		}
+
+		printf("SUMMARY_LATENCY op=%s ops=%lu p50_ns=%.0f p99_ns=%.0f p999_ns=%.0f max_ns=%.0f\n",
+		       op_names[op], total.count,
+		       timer_ticks_to_ns(latency_hist_percentile(&total, 50.0)),
+		       timer_ticks_to_ns(latency_hist_percentile(&total, 99.0)),
+		       timer_ticks_to_ns(latency_hist_percentile(&total, 99.9)),
+		       timer_ticks_to_ns(total.max));
+	}
+}
+
+/*
+ * With --sweep or --rate-sweep, each run is a CSV row under this header.
+ * The latency columns are over all operation types, in ns, and empty
+ * unless operations were timed (--latency, or any open loop run).
+ */
+void print_csv_header(void)
+{
+	printf("variant,fg_lock,pin,threads,arrivals,offered_rate,create_file,test_file,keys,"
+	       "build_time,ops,run_time,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+}
+
+void print_csv_row(struct thread_info *tinfo, size_t keys, double build_time, double run_time)
+{
+	static Latency_Hist total;
+	unsigned long ops = 0;
+
+	for (int i = 0; i < num_threads; i++) {
+		ops += tinfo[i].ops;
+	}
+
+	printf("%s,%s,%s,%d,%s,%.1f,%s,%s,%zu,%.6f,%lu,%.6f,%.1f,", variant_name(), fg_lock_name(),
+	       pin_policy_name(pin_policy), num_threads, arrival_names[arrivals], offered_rate,
+	       create_file, test_file, keys, build_time, ops, run_time, run_time > 0 ? ops / run_time : 0.0);
+
+	latency_hist_reset(&total);
+	for (int i = 0; record_latency && i < num_threads; i++) {
+		for (int op = 0; op < NUM_OP_TYPES; op++) {
+			latency_hist_merge(&total, &op_latency[i][op]);
+		}
+	}
+
+	if (total.count == 0) {
+		printf(",,,\n");
+		return;
+	}
+
+	printf("%.0f,%.0f,%.0f,%.0f\n",
+	       timer_ticks_to_ns(latency_hist_percentile(&total, 50.0)),
+	       timer_ticks_to_ns(latency_hist_percentile(&total, 99.0)),
+	       timer_ticks_to_ns(latency_hist_percentile(&total, 99.9)),
+	       timer_ticks_to_ns(total.max));
 }
@@ -1,15 +1,76 @@
 #ifndef _TEST_HARNESS_H
 #define _TEST_HARNESS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 enum operation_type {
 	INSERT = 0,
 	SEARCH,
-	DELETE
+	DELETE,
+	NUM_OP_TYPES
+};
+
+enum tree_type {
+	FG_TREE = 0,
+	LF_TREE,
+	CHROMATIC_TREE,
+	EXTERNAL_TREE
+};
+
+/*
+ * Generated workloads (--duration). The defaults are Synchrobench's: 20%
+ * updates, over a key range twice the size the tree settles at.
+ */
+#define DEFAULT_WARMUP			1.0
+#define DEFAULT_INSERT_PCT		10
+#define DEFAULT_SEARCH_PCT		80
+#define DEFAULT_DELETE_PCT		10
+#define DEFAULT_KEY_RANGE		(1 << 20)
+#define MAX_KEY_RANGE			(1 << 30)
+#define DEFAULT_SEED			1
+
+/*
+ * How operations arrive. Closed loop issues each as soon as the last is
+ * done; the others are open loop, and hold each operation back until its
+ * scheduled start. A rate sweep stops at the first offered load the tree
+ * completes less than RATE_SWEEP_SATURATION of.
+ */
+enum arrival_type {
+	ARRIVALS_CLOSED = 0,
+	ARRIVALS_POISSON,
+	ARRIVALS_FIXED,
+	ARRIVALS_TRACE
+};
+
+#define RATE_SWEEP_SATURATION		0.95
+
+enum bench_phase {
+	PHASE_WARMUP = 0,
+	PHASE_MEASURE,
+	PHASE_STOP
 };
 
 typedef struct work {
 	int value;
 	int op_type;
+	uint64_t arrival;	// ns from the start of the trace, if it has timestamps
 } WORK;
 
+/*
+ * A trace can be cut into phases by "phase <n>" lines. Every worker
+ * finishes one phase before any starts on the next, and each phase is
+ * reported on its own, along with the memory, the reclaimer's backlog and
+ * the tree height it left behind.
+ */
+typedef struct phase_stats {
+	size_t start;			// its first operation in the dispatcher
+	unsigned long ops[NUM_OP_TYPES];
+	double start_time;
+	double end_time;
+	long rss_kb;
+	unsigned long retired;		// retired, not yet freed
+	int height;
+} Phase_Stats;
+
 #endif
@@ -1,11 +1,27 @@
 #ifndef _THREADS_H_
 #define _THREADS_H_
 
-#define MAX_THREADS		24
+#include <pthread.h>
+
+/*
+ * MAX_THREADS only sizes the per-thread arrays. The harness runs
+ * num_threads threads (--threads, or each count of a --sweep), numbered
+ * from 0, and DEFAULT_THREADS if it isn't told otherwise.
+ */
+#define MAX_THREADS		256
+#define DEFAULT_THREADS		24
+
+// For keeping per-thread data out of each other's cache lines
+#define CACHE_LINE_SIZE		64
+
+extern int num_threads;
 
 struct thread_info {
 	pthread_t	thread_id;
 	int		thread_num;
+	unsigned long	ops;		// operations done in the measured phase
+	double		start_time;	// when it got past the start barrier
+	double		end_time;	// when it ran out of work
 };
 
 #endif
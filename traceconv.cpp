@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "test_harness.h"
+#include "Trace_Format.h"
+
+/*
+ * Converts traces between the text format and the binary one (see
+ * Trace_Format.h), in whichever direction the input calls for. Text traces
+ * are read exactly as the harness reads them: "<op> <key> [<arrival in
+ * us>]" lines, and "phase <n>" lines between phases.
+ */
+static const char *op_names[NUM_OP_TYPES] = {"insert", "search", "delete"};
+static Trace_Writer writer;
+
+static int text_to_binary(const char *in_name, const char *out_name)
+{
+	FILE *in = fopen(in_name, "r");
+	char line[256], op[16];
+	unsigned long line_num = 0;
+	long key;
+	double arrival;
+	int fields, op_type, ret;
+
+	if (in == NULL) {
+		printf("Could not open %s: %s\n", in_name, strerror(errno));
+		return -1;
+	}
+
+	ret = trace_writer_open(&writer, out_name);
+	if (ret != 0) {
+		printf("Could not create %s: %s\n", out_name, strerror(-ret));
+		fclose(in);
+		return -1;
+	}
+
+	while (ret == 0 && fgets(line, sizeof(line), in) != NULL) {
+		line_num++;
+		fields = sscanf(line, "%15s %ld %lf", op, &key, &arrival);
+		if (fields < 2 || key < INT_MIN || key > INT_MAX) {
+			printf("%s:%lu: not an operation\n", in_name, line_num);
+			ret = -EINVAL;
+			break;
+		}
+
+		if (strcmp(op, "phase") == 0) {
+			ret = trace_write_phase(&writer);
+			continue;
+		}
+
+		for (op_type = 0; op_type < NUM_OP_TYPES; op_type++) {
+			if (strcmp(op, op_names[op_type]) == 0) {
+				break;
+			}
+		}
+		if (op_type == NUM_OP_TYPES) {
+			printf("%s:%lu: unknown operation %s\n", in_name, line_num, op);
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = trace_write_op(&writer, op_type, key, fields == 3 ? (uint64_t)(arrival * 1000) : 0,
+				     fields == 3);
+	}
+	fclose(in);
+
+	if (trace_writer_close(&writer) != 0 && ret == 0) {
+		printf("Could not write %s\n", out_name);
+		ret = -EIO;
+	}
+	if (ret != 0) {
+		remove(out_name);
+		return -1;
+	}
+
+	printf("%s: %lu operations in %lu phases%s\n", out_name, (unsigned long)writer.header.num_records,
+	       (unsigned long)writer.header.num_phases,
+	       (writer.header.flags & TRACE_HAS_ARRIVALS) ? ", with arrival times" : "");
+	return 0;
+}
+
+/*
+ * The other way, mostly for looking at binary traces
+ */
+static int binary_to_text(const char *in_name, const char *out_name)
+{
+	Trace_Map map;
+	FILE *out;
+	uint64_t phase = 0;
+	bool timed;
+	int ret;
+
+	ret = trace_map(&map, in_name);
+	if (ret != 0) {
+		printf("Could not map %s: %s\n", in_name, strerror(-ret));
+		return -1;
+	}
+
+	out = fopen(out_name, "w");
+	if (out == NULL) {
+		printf("Could not create %s: %s\n", out_name, strerror(errno));
+		trace_unmap(&map);
+		return -1;
+	}
+
+	timed = map.header->flags & TRACE_HAS_ARRIVALS;
+	for (uint64_t i = 0; i < map.header->num_records; i++) {
+		const WORK *w = &map.records[i];
+
+		// Only traces with more than one phase had markers to begin with
+		while (map.header->num_phases > 1 && phase < map.header->num_phases &&
+		       map.phases[phase].start == i) {
+			fprintf(out, "phase %lu\n", (unsigned long)phase++);
+		}
+
+		if (w->op_type < 0 || w->op_type >= NUM_OP_TYPES) {
+			printf("%s: record %lu has no operation %d\n", in_name, (unsigned long)i, w->op_type);
+			fclose(out);
+			trace_unmap(&map);
+			return -1;
+		}
+
+		if (timed) {
+			fprintf(out, "%s %d %.3f\n", op_names[w->op_type], w->value, w->arrival / 1000.0);
+		} else {
+			fprintf(out, "%s %d\n", op_names[w->op_type], w->value);
+		}
+	}
+
+	ret = ferror(out);
+	if (fclose(out) != 0 || ret != 0) {
+		printf("Could not write %s\n", out_name);
+		trace_unmap(&map);
+		return -1;
+	}
+
+	trace_unmap(&map);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3) {
+		printf("Usage: ./traceconv <input trace> <output trace>\n"
+		       "  Converts a text trace to the binary format, or a binary one to text\n");
+		return -1;
+	}
+
+	if (trace_is_binary(argv[1])) {
+		return binary_to_text(argv[1], argv[2]);
+	}
+	return text_to_binary(argv[1], argv[2]);
+}
@@ -6,75 +6,442 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <math.h>
 #include <assert.h>
 #include <getopt.h>
+#include <limits.h>
 #include <linux/limits.h>
 
+#include "Rand.h"
+#include "Trace_Format.h"
+
 #define MIXED_WORKLOAD_STEP		500
+#define OUT_BUF_SIZE			(1 << 20)
+#define OUT_LINE_MAX			64
+
+/*
+ * Defaults for the random types: YCSB's Zipf constant, and 80% of the
+ * operations on 20% of the keys for HOTSPOT
+ */
+#define DEFAULT_NUM_KEYS		(1UL << 20)
+#define DEFAULT_THETA			0.99
+#define DEFAULT_HOT_FRACTION		0.2
+#define DEFAULT_HOT_OPS			0.8
+#define DEFAULT_SEED			1
+
+/*
+ * Defaults for DRIFT: insert-heavy bursts alternating with delete-heavy
+ * drains, with the window moving a quarter of its width every phase
+ */
+#define DEFAULT_PHASES			8
+#define DEFAULT_PHASE_OPS		100000
+#define DEFAULT_PHASE_MIX		"60,30,10/10,30,60"
+#define DEFAULT_EXPIRE_EVERY		1
+#define MAX_PHASE_MIXES			16
+
 int fd;
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_len;
+static bool binary_output;		// --binary: write the harness's binary format
+static Trace_Writer writer;
 
 enum type {
 	SEQUENTIAL = 1,
 	LOW_CONTENTION,
-	MIXED
+	MIXED,
+	UNIFORM,
+	ZIPF,
+	LATEST,
+	HOTSPOT,
+	DRIFT,
+	NUM_TYPES
+};
+
+static const char *type_names[NUM_TYPES] = {
+	NULL, "sequential", "low-contention", "mixed", "uniform", "zipf", "latest", "hotspot", "drift"
 };
 
+/*
+ * Where the random types draw their keys from. Keys are 1 to num_keys.
+ *
+ * UNIFORM: every key equally likely.
+ * ZIPF: the key of popularity rank r is picked with probability
+ * proportional to 1 / r^theta, and the ranks are hashed over the key space
+ * so that the popular keys are scattered rather than all in one subtree
+ * (YCSB's scrambled Zipfian).
+ * LATEST: inserts add new keys above num_keys, one after another, and
+ * everything else picks keys Zipfian by how recently they were inserted,
+ * the newest first (YCSB's latest).
+ * HOTSPOT: hot_ops of the operations go to the lowest hot_fraction of the
+ * keys, and the rest to the others, uniformly within each.
+ */
+typedef struct Key_Generator {
+	Rand_State rand;
+	int type;
+	unsigned long num_keys;
+	unsigned long next_key;		// LATEST: the key the next insert adds
+	unsigned long key_base;		// DRIFT: added to every key, to move the window
+	double theta;
+	double hot_fraction;
+	double hot_ops;
+
+	// Zipfian ranks 0 to zipf_n - 1 (Gray et al., "Quickly Generating
+	// Billion-Record Synthetic Databases", SIGMOD 1994)
+	unsigned long zipf_n;
+	double zeta2, zetan, alpha, eta;
+} Key_Gen;
+
+/*
+ * DRIFT: phases of phase_ops operations, each starting with a "phase <n>"
+ * line. Phase p takes its insert, search and delete percentages from
+ * mix[p % num_mixes], and its keys from a window of num_keys keys, drawn
+ * as key_dist says, that moves up by window_shift after every phase. Every
+ * expire_every phases (never, if 0), a phase of its own deletes all the
+ * keys that have slid out of the window since the last one, oldest first,
+ * the way a cache or a TTL index expires a time range in bulk.
+ */
+typedef struct Phase_Plan {
+	unsigned long phases;
+	unsigned long phase_ops;
+	int mix[MAX_PHASE_MIXES][3];
+	int num_mixes;
+	unsigned long window_shift;
+	unsigned long expire_every;
+} Phase_Plan;
+
 static struct option long_options[] =
 {
 	{"insert", required_argument, 0, 'i'},
 	{"delete", required_argument, 0, 'd'},
 	{"search", required_argument, 0, 's'},
 	{"name", required_argument, 0, 'n'},
-	{"type", required_argument, 0, 't'}
+	{"type", required_argument, 0, 't'},
+	{"keys", required_argument, 0, 'k'},
+	{"theta", required_argument, 0, 'z'},
+	{"hot-fraction", required_argument, 0, 'f'},
+	{"hot-ops", required_argument, 0, 'o'},
+	{"seed", required_argument, 0, 'r'},
+	{"phases", required_argument, 0, 'p'},
+	{"phase-ops", required_argument, 0, 'P'},
+	{"phase-mix", required_argument, 0, 'm'},
+	{"window-shift", required_argument, 0, 'w'},
+	{"expire-every", required_argument, 0, 'e'},
+	{"key-dist", required_argument, 0, 'K'},
+	{"binary", no_argument, 0, 'b'},
+	{0, 0, 0, 0}
 };
 
-void create_lc_trace(unsigned long elem, unsigned long range)
+static int flush_trace(void)
 {
-	char buf[64];
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < out_len) {
+		ret = write(fd, out_buf + done, out_len - done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			printf("write failed\n");
+			return -1;
+		}
+		done += ret;
+	}
 
-	if (range == 1)
-		return;
+	out_len = 0;
+	return 0;
+}
 
-	sprintf(buf, "insert %lu\n", elem - range / 2);
+/*
+ * The binary format has an int key and an op code where the text has words
+ */
+static int emit_binary(const char *op, unsigned long key)
+{
+	int op_type;
 
-	if (write(fd, buf, strlen(buf)) < 0) {
-		printf("write failed\n");
-		close(fd);
-		return;
+	if (strcmp(op, "phase") == 0) {
+		return trace_write_phase(&writer);
 	}
 
-	sprintf(buf, "insert %lu\n", elem + range / 2);
+	if (key > INT_MAX) {
+		printf("key %lu doesn't fit in a binary trace\n", key);
+		return -1;
+	}
+
+	if (strcmp(op, "insert") == 0) {
+		op_type = INSERT;
+	} else if (strcmp(op, "search") == 0) {
+		op_type = SEARCH;
+	} else {
+		op_type = DELETE;
+	}
 
-	if (write(fd, buf, strlen(buf)) < 0) {
+	if (trace_write_op(&writer, op_type, key, 0, false) != 0) {
 		printf("write failed\n");
-		close(fd);
-		return;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Add a line to the trace. Lines collect in out_buf, which goes out in
+ * one write() whenever it fills up.
+ */
+static int emit(const char *op, unsigned long key)
+{
+	if (binary_output) {
+		return emit_binary(op, key);
+	}
+
+	if (OUT_BUF_SIZE - out_len < OUT_LINE_MAX && flush_trace() != 0) {
+		return -1;
+	}
+
+	out_len += snprintf(out_buf + out_len, OUT_LINE_MAX, "%s %lu\n", op, key);
+	return 0;
+}
+
+static double rand_double(Rand_State *r)
+{
+	return (rand_next(r) >> 11) / 9007199254740992.0;
+}
+
+static double zeta(unsigned long from, unsigned long to, double theta)
+{
+	double sum = 0;
+
+	for (unsigned long i = from + 1; i <= to; i++) {
+		sum += 1.0 / pow((double)i, theta);
+	}
+	return sum;
+}
+
+/*
+ * Make room for ranks up to n - 1. Growing only costs the new terms of
+ * zeta(n), so LATEST can grow by one on every insert.
+ */
+static void zipf_grow(Key_Gen *g, unsigned long n)
+{
+	if (g->zipf_n == 0) {
+		g->zeta2 = zeta(0, 2, g->theta);
+		g->alpha = 1.0 / (1.0 - g->theta);
+	}
+
+	g->zetan += zeta(g->zipf_n, n, g->theta);
+	g->zipf_n = n;
+	g->eta = (1 - pow(2.0 / n, 1 - g->theta)) / (1 - g->zeta2 / g->zetan);
+}
+
+static unsigned long zipf_next(Key_Gen *g)
+{
+	double u = rand_double(&g->rand);
+	double uz = u * g->zetan;
+	unsigned long rank;
+
+	if (uz < 1.0) {
+		return 0;
+	}
+	if (uz < 1.0 + pow(0.5, g->theta)) {
+		return 1;
+	}
+
+	rank = (unsigned long)(g->zipf_n * pow(g->eta * u - g->eta + 1, g->alpha));
+	return rank < g->zipf_n ? rank : g->zipf_n - 1;
+}
+
+/*
+ * FNV-1a, to scatter Zipfian ranks over the keys
+ */
+static uint64_t fnv_hash(uint64_t value)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (int i = 0; i < 8; i++) {
+		hash ^= value & 0xff;
+		hash *= 0x100000001b3ULL;
+		value >>= 8;
+	}
+	return hash;
+}
+
+static void key_gen_init(Key_Gen *g, int type, unsigned long num_keys, double theta,
+			 double hot_fraction, double hot_ops, unsigned long seed)
+{
+	memset(g, 0, sizeof(*g));
+	rand_seed(&g->rand, seed);
+	g->type = type;
+	g->num_keys = num_keys;
+	g->next_key = num_keys + 1;
+	g->theta = theta;
+	g->hot_fraction = hot_fraction;
+	g->hot_ops = hot_ops;
+
+	if (type == ZIPF || type == LATEST) {
+		zipf_grow(g, num_keys);
+	}
+}
+
+static unsigned long next_key(Key_Gen *g, int op)
+{
+	unsigned long hot_keys;
+
+	switch (g->type) {
+	case ZIPF:
+		return 1 + fnv_hash(zipf_next(g)) % g->num_keys;
+
+	case LATEST:
+		if (op == 'i') {
+			zipf_grow(g, g->next_key);
+			return g->next_key++;
+		}
+		return g->next_key - 1 - zipf_next(g);
+
+	case HOTSPOT:
+		hot_keys = (unsigned long)(g->hot_fraction * g->num_keys);
+		if (hot_keys == 0) {
+			hot_keys = 1;
+		}
+		if (hot_keys == g->num_keys || rand_double(&g->rand) < g->hot_ops) {
+			return 1 + rand_below(&g->rand, hot_keys);
+		}
+		return hot_keys + 1 + rand_below(&g->rand, g->num_keys - hot_keys);
+
+	default:
+		return 1 + rand_below(&g->rand, g->num_keys);
+	}
+}
+
+/*
+ * The random types: the requested number of each operation, in random
+ * order, on keys drawn from g
+ */
+static int create_random_trace(unsigned long num_inserts, unsigned long num_deletes,
+			       unsigned long num_searches, Key_Gen *g)
+{
+	unsigned long left = num_inserts + num_deletes + num_searches, pick;
+
+	for (; left > 0; left--) {
+		pick = rand_below(&g->rand, left);
+
+		if (pick < num_inserts) {
+			num_inserts--;
+			if (emit("insert", g->key_base + next_key(g, 'i')) != 0) {
+				return -1;
+			}
+		} else if (pick < num_inserts + num_searches) {
+			num_searches--;
+			if (emit("search", g->key_base + next_key(g, 's')) != 0) {
+				return -1;
+			}
+		} else {
+			num_deletes--;
+			if (emit("delete", g->key_base + next_key(g, 'd')) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int create_drift_trace(Phase_Plan *plan, Key_Gen *g)
+{
+	unsigned long phase = 0, expired = 1, inserts, searches, deletes;
+	const int *mix;
+
+	for (unsigned long p = 0; p < plan->phases; p++) {
+		mix = plan->mix[p % plan->num_mixes];
+		inserts = plan->phase_ops * mix[0] / 100;
+		deletes = plan->phase_ops * mix[2] / 100;
+		searches = plan->phase_ops - inserts - deletes;
+
+		if (emit("phase", phase++) != 0) {
+			return -1;
+		}
+		if (create_random_trace(inserts, deletes, searches, g) != 0) {
+			return -1;
+		}
+		g->key_base += plan->window_shift;
+
+		// Everything below the window's new start is due
+		if (plan->expire_every == 0 || (p + 1) % plan->expire_every != 0 ||
+		    expired > g->key_base) {
+			continue;
+		}
+
+		if (emit("phase", phase++) != 0) {
+			return -1;
+		}
+		for (; expired <= g->key_base; expired++) {
+			if (emit("delete", expired) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	printf("%lu phases, keys %lu to %lu at the end\n", phase, g->key_base + 1,
+	       g->key_base + g->num_keys);
+	return 0;
+}
+
+int create_lc_trace(unsigned long elem, unsigned long range)
+{
+	if (range == 1)
+		return 0;
+
+	if (emit("insert", elem - range / 2) != 0) {
+		return -1;
 	}
 
-	create_lc_trace(elem - range / 2, range / 2);
-	create_lc_trace(elem + range / 2, range / 2);
+	if (emit("insert", elem + range / 2) != 0) {
+		return -1;
+	}
+
+	if (create_lc_trace(elem - range / 2, range / 2) != 0) {
+		return -1;
+	}
+	return create_lc_trace(elem + range / 2, range / 2);
+}
+
+/*
+ * Don't leave a partial trace behind when generating it fails: a truncated
+ * text trace would pass for a short one, and a binary one has no header
+ * yet
+ */
+static void discard_trace(const char *fname)
+{
+	if (binary_output) {
+		trace_writer_close(&writer);
+	} else {
+		close(fd);
+	}
+	remove(fname);
 }
 
 int generate_trace_file(unsigned long num_inserts, unsigned long num_deletes, unsigned long num_searches,
-			char *fname, int type)
+			char *fname, int type, Key_Gen *g, Phase_Plan *plan)
 {
 	unsigned long count = 1, start, end;
-	char buf[128];
 
 	// create the trace file
 	printf("fname = %s\n", fname);
-	fd = creat(fname, 0644);
+	if (binary_output) {
+		fd = trace_writer_open(&writer, fname) == 0 ? writer.fd : -1;
+	} else {
+		fd = creat(fname, 0644);
+	}
 	if (fd < 0) {
 		printf("Could not open the file\n");
+		return -1;
 	}
+	out_len = 0;
 
 	if (type == SEQUENTIAL) {
 		// Do all the inserts
 		while (count <= num_inserts) {
-			sprintf(buf, "insert %lu\n", count++);
-			if (write(fd, buf, strlen(buf)) < 0) {
-				printf("write failed\n");
-				close(fd);
+			if (emit("insert", count++) != 0) {
+				discard_trace(fname);
 				return -1;
 			}
 		}
@@ -82,10 +449,8 @@ int generate_trace_file(unsigned long num_inserts, unsigned long num_deletes, un
 		count = 1;
 		// Do all the searches
 		while (count <= num_searches) {
-			sprintf(buf, "search %lu\n", count++);
-			if (write(fd, buf, strlen(buf)) < 0) {
-				printf("write failed\n");
-				close(fd);
+			if (emit("search", count++) != 0) {
+				discard_trace(fname);
 				return -1;
 			}
 		}
@@ -93,39 +458,34 @@ int generate_trace_file(unsigned long num_inserts, unsigned long num_deletes, un
 		count = 1;
 		// Do all the deletes
 		while (count <= num_deletes) {
-			sprintf(buf, "delete %lu\n", count++);
-			if (write(fd, buf, strlen(buf)) < 0) {
-				printf("write failed\n");
-				close(fd);
+			if (emit("delete", count++) != 0) {
+				discard_trace(fname);
 				return -1;
 			}
 		}
 	} else if (type == LOW_CONTENTION) {
 		if (num_inserts != 0) {
-			sprintf(buf, "insert %lu\n", num_inserts / 2);
-			if (write(fd, buf, strlen(buf)) < 0) {
-				printf("write failed\n");
-				close(fd);
+			if (emit("insert", num_inserts / 2) != 0) {
+				discard_trace(fname);
+				return -1;
+			}
+			if (create_lc_trace(num_inserts / 2, num_inserts / 2) != 0) {
+				discard_trace(fname);
 				return -1;
 			}
-			create_lc_trace(num_inserts / 2, num_inserts / 2);
 		}
 
 		if (num_searches != 0) {
 			start = 1, end = num_searches - 1;
 			while (start <= end) {
-				sprintf(buf, "search %lu\n", start);
-				if (write(fd, buf, strlen(buf)) < 0) {
-					printf("write failed\n");
-					close(fd);
+				if (emit("search", start) != 0) {
+					discard_trace(fname);
 					return -1;
 				}
 
 				if (start != end) {
-					sprintf(buf, "search %lu\n", end);
-					if (write(fd, buf, strlen(buf)) < 0) {
-						printf("write failed\n");
-						close(fd);
+					if (emit("search", end) != 0) {
+						discard_trace(fname);
 						return -1;
 					}
 				}
@@ -138,18 +498,14 @@ int generate_trace_file(unsigned long num_inserts, unsigned long num_deletes, un
 		if (num_deletes != 0) {
 			start = 1, end = num_deletes - 1;
 			while (start <= end) {
-				sprintf(buf, "delete %lu\n", start);
-				if (write(fd, buf, strlen(buf)) < 0) {
-					printf("write failed\n");
-					close(fd);
+				if (emit("delete", start) != 0) {
+					discard_trace(fname);
 					return -1;
 				}
 
 				if (start != end) {
-					sprintf(buf, "delete %lu\n", end);
-					if (write(fd, buf, strlen(buf)) < 0) {
-						printf("write failed\n");
-						close(fd);
+					if (emit("delete", end) != 0) {
+						discard_trace(fname);
 						return -1;
 					}
 				}
@@ -164,73 +520,214 @@ int generate_trace_file(unsigned long num_inserts, unsigned long num_deletes, un
 		while (completed < num_inserts) {
 			unsigned long counter = 1;
 			while (counter <= MIXED_WORKLOAD_STEP) {
-				sprintf(buf, "insert %lu\n", completed + counter++);
-				if (write(fd, buf, strlen(buf)) < 0) {
-					printf("write failed\n");
-					close(fd);
+				if (emit("insert", completed + counter++) != 0) {
+					discard_trace(fname);
 					return -1;
 				}
 			}
 
 			counter = 1;
 			while (counter <= MIXED_WORKLOAD_STEP) {
-				sprintf(buf, "search %lu\n", completed + counter++);
-				if (write(fd, buf, strlen(buf)) < 0) {
-					printf("write failed\n");
-					close(fd);
+				if (emit("search", completed + counter++) != 0) {
+					discard_trace(fname);
 					return -1;
 				}
 			}
 
 			counter = 1;
 			while (counter <= MIXED_WORKLOAD_STEP) {
-				sprintf(buf, "delete %lu\n", completed + counter++);
-				if (write(fd, buf, strlen(buf)) < 0) {
-					printf("write failed\n");
-					close(fd);
+				if (emit("delete", completed + counter++) != 0) {
+					discard_trace(fname);
 					return -1;
 				}
 			}
 
 			completed += MIXED_WORKLOAD_STEP;
 		}
+	} else if (type == DRIFT) {
+		if (create_drift_trace(plan, g) != 0) {
+			discard_trace(fname);
+			return -1;
+		}
+	} else {
+		if (create_random_trace(num_inserts, num_deletes, num_searches, g) != 0) {
+			discard_trace(fname);
+			return -1;
+		}
 	}
 
+	if (binary_output) {
+		if (trace_writer_close(&writer) != 0) {
+			printf("write failed\n");
+			remove(fname);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (flush_trace() != 0) {
+		discard_trace(fname);
+		return -1;
+	}
 	close(fd);
 
 	return 0;
 }
 
-int main (int argc, char **argv)
+static int parse_type(const char *arg)
 {
-	int idx = 0, c;
-	unsigned long num_inserts = 0, num_deletes = 0, num_searches = 0, type = SEQUENTIAL;
-	char fname[PATH_MAX];
+	char *end;
+	long type = strtol(arg, &end, 10);
+
+	if (*arg != '\0' && *end == '\0') {
+		return (type >= SEQUENTIAL && type < NUM_TYPES) ? type : -1;
+	}
+
+	for (int i = SEQUENTIAL; i < NUM_TYPES; i++) {
+		if (strcmp(arg, type_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
 
-	if (argc != 4 && argc != 6) {
-		printf("Usage: ./tracegen --insert=x --delete=y --search=z --name=n --type=t\n");
+/*
+ * Counts and fractions have to be all number: strtoul() would take "-1"
+ * as ULONG_MAX, and atof() takes garbage as 0
+ */
+static int parse_count(const char *arg, unsigned long *count)
+{
+	char *end;
+
+	if (*arg < '0' || *arg > '9') {
 		return -1;
 	}
 
+	errno = 0;
+	*count = strtoul(arg, &end, 10);
+	return (*end == '\0' && errno == 0) ? 0 : -1;
+}
+
+static int parse_fraction(const char *arg, double *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtod(arg, &end);
+	return (*arg != '\0' && *end == '\0' && errno == 0) ? 0 : -1;
+}
+
+static const char *option_name(int c)
+{
+	for (int i = 0; long_options[i].name != NULL; i++) {
+		if (long_options[i].val == c) {
+			return long_options[i].name;
+		}
+	}
+	return "?";
+}
+
+/*
+ * Percentages of inserts, searches and deletes for each phase of DRIFT,
+ * e.g. "60,30,10/10,30,60"
+ */
+static int parse_phase_mix(const char *list, Phase_Plan *plan)
+{
+	const char *pos = list;
+	int *mix, used;
+
+	plan->num_mixes = 0;
+	while (plan->num_mixes < MAX_PHASE_MIXES) {
+		mix = plan->mix[plan->num_mixes++];
+		if (sscanf(pos, "%d,%d,%d%n", &mix[0], &mix[1], &mix[2], &used) != 3 ||
+		    mix[0] < 0 || mix[1] < 0 || mix[2] < 0 || mix[0] + mix[1] + mix[2] != 100) {
+			return -1;
+		}
+
+		pos += used;
+		if (*pos == '\0') {
+			return 0;
+		}
+		if (*pos != '/') {
+			return -1;
+		}
+		pos++;
+	}
+	return -1;
+}
+
+static void print_usage(void)
+{
+	printf("Usage: ./tracegen --insert=x --delete=y --search=z --name=n [--type=t] [--binary]\n"
+	       "                  [--keys=k] [--theta=z] [--hot-fraction=f] [--hot-ops=o] [--seed=s]\n"
+	       "       ./tracegen --type=drift --name=n [--phases=p] [--phase-ops=o] [--phase-mix=i,s,d/...]\n"
+	       "                  [--window-shift=w] [--expire-every=e] [--key-dist=d] [--keys=k] ...\n"
+	       "  --binary     write the binary format, which the harness maps instead of\n"
+	       "               parsing (see Trace_Format.h)\n"
+	       "  --type       1 or sequential, 2 or low-contention, 3 or mixed (the default is\n"
+	       "               sequential), or one of the random types, with keys 1 to --keys:\n"
+	       "               4 or uniform, 5 or zipf, 6 or latest, 7 or hotspot, or 8 or drift,\n"
+	       "               phases of changing mixes over a moving window of --keys keys\n"
+	       "  --keys       number of keys for the random types (default %lu)\n"
+	       "  --theta      Zipf constant for zipf and latest, 0 < theta < 1 (default %.2f)\n"
+	       "  --hot-fraction\n"
+	       "               hotspot: fraction of the keys that are hot (default %.2f)\n"
+	       "  --hot-ops    hotspot: fraction of the operations on the hot keys (default %.2f)\n"
+	       "  --seed       seed for the random types; the same seed gives the same trace\n"
+	       "               (default %d)\n"
+	       "  --phases     drift: number of phases, not counting expiry (default %d)\n"
+	       "  --phase-ops  drift: operations per phase (default %d)\n"
+	       "  --phase-mix  drift: insert,search,delete percentages of each phase in turn,\n"
+	       "               separated by '/' (default %s)\n"
+	       "  --window-shift\n"
+	       "               drift: how far the key window moves after each phase (default\n"
+	       "               --keys / 4)\n"
+	       "  --expire-every\n"
+	       "               drift: delete the keys below the window every this many phases,\n"
+	       "               0 for never (default %d)\n"
+	       "  --key-dist   drift: uniform, zipf or hotspot keys within the window (default\n"
+	       "               uniform)\n",
+	       DEFAULT_NUM_KEYS, DEFAULT_THETA, DEFAULT_HOT_FRACTION, DEFAULT_HOT_OPS, DEFAULT_SEED,
+	       DEFAULT_PHASES, DEFAULT_PHASE_OPS, DEFAULT_PHASE_MIX, DEFAULT_EXPIRE_EVERY);
+}
+
+int main (int argc, char **argv)
+{
+	int idx = 0, c, ret;
+	unsigned long num_inserts = 0, num_deletes = 0, num_searches = 0;
+	unsigned long num_keys = DEFAULT_NUM_KEYS, seed = DEFAULT_SEED;
+	double theta = DEFAULT_THETA, hot_fraction = DEFAULT_HOT_FRACTION, hot_ops = DEFAULT_HOT_OPS;
+	int type = SEQUENTIAL, key_dist = UNIFORM;
+	bool window_shift_set = false;
+	char fname[PATH_MAX] = "";
+	Key_Gen g;
+	Phase_Plan plan;
+
+	plan.phases = DEFAULT_PHASES;
+	plan.phase_ops = DEFAULT_PHASE_OPS;
+	plan.expire_every = DEFAULT_EXPIRE_EVERY;
+	parse_phase_mix(DEFAULT_PHASE_MIX, &plan);
+
 	while (true) {
-		c = getopt_long(argc, argv, "i:d:s:t:", long_options, &idx);
+		c = getopt_long(argc, argv, "i:d:s:n:t:k:z:f:o:r:p:P:m:w:e:K:b", long_options, &idx);
 
 		if (-1 == c) {
 			// End of options
 			break;
 		}
 
+		ret = 0;
 		switch (c) {
 			case 'i':
-				num_inserts = strtoul(optarg, NULL, 10);
+				ret = parse_count(optarg, &num_inserts);
 				break;
 
 			case 'd':
-				num_deletes = strtoul(optarg, NULL, 10);
+				ret = parse_count(optarg, &num_deletes);
 				break;
 
 			case 's':
-				num_searches = strtoul(optarg, NULL, 10);
+				ret = parse_count(optarg, &num_searches);
 				break;
 
 			case 'n':
@@ -238,12 +735,120 @@ int main (int argc, char **argv)
 				break;
 
 			case 't':
-				type = atoi(optarg);
+				type = parse_type(optarg);
+				if (type < 0) {
+					printf("Unknown trace type %s\n", optarg);
+					print_usage();
+					return -1;
+				}
+				break;
+
+			case 'k':
+				ret = parse_count(optarg, &num_keys);
+				break;
+
+			case 'z':
+				ret = parse_fraction(optarg, &theta);
+				break;
+
+			case 'f':
+				ret = parse_fraction(optarg, &hot_fraction);
+				break;
+
+			case 'o':
+				ret = parse_fraction(optarg, &hot_ops);
+				break;
+
+			case 'r':
+				ret = parse_count(optarg, &seed);
+				break;
+
+			case 'p':
+				ret = parse_count(optarg, &plan.phases);
+				break;
+
+			case 'P':
+				ret = parse_count(optarg, &plan.phase_ops);
+				break;
+
+			case 'm':
+				if (parse_phase_mix(optarg, &plan) != 0) {
+					printf("--phase-mix wants up to %d insert,search,delete triples adding "
+					       "up to 100, separated by '/'\n", MAX_PHASE_MIXES);
+					return -1;
+				}
+				break;
+
+			case 'w':
+				ret = parse_count(optarg, &plan.window_shift);
+				window_shift_set = true;
+				break;
+
+			case 'e':
+				ret = parse_count(optarg, &plan.expire_every);
+				break;
+
+			case 'b':
+				binary_output = true;
+				break;
+
+			case 'K':
+				key_dist = parse_type(optarg);
+				if (key_dist != UNIFORM && key_dist != ZIPF && key_dist != HOTSPOT) {
+					printf("--key-dist must be uniform, zipf or hotspot\n");
+					return -1;
+				}
 				break;
+
+			default:
+				print_usage();
+				return -1;
+		}
+
+		if (ret != 0) {
+			printf("--%s wants a number, not %s\n", option_name(c), optarg);
+			return -1;
 		}
 	}
 
-	generate_trace_file(num_inserts, num_deletes, num_searches, fname, type);
+	if (fname[0] == '\0') {
+		print_usage();
+		return -1;
+	}
+
+	// The harness keeps keys in an int
+	if (num_keys == 0 || num_keys > INT_MAX) {
+		printf("--keys must be between 1 and %d\n", INT_MAX);
+		return -1;
+	}
+
+	// The rejection-free Zipf method needs theta strictly between 0 and 1
+	if (!(theta > 0 && theta < 1)) {
+		printf("--theta must be between 0 and 1\n");
+		return -1;
+	}
+
+	if (!(hot_fraction > 0 && hot_fraction <= 1) || !(hot_ops >= 0 && hot_ops <= 1)) {
+		printf("--hot-fraction must be in (0, 1] and --hot-ops in [0, 1]\n");
+		return -1;
+	}
+
+	if (type == DRIFT) {
+		if (!window_shift_set) {
+			plan.window_shift = num_keys / 4;
+		}
+
+		if (plan.window_shift > 0 && plan.phases > (INT_MAX - num_keys) / plan.window_shift) {
+			printf("drift: the window would move past %d\n", INT_MAX);
+			return -1;
+		}
+	}
+
+	key_gen_init(&g, type == DRIFT ? key_dist : type, num_keys, theta, hot_fraction, hot_ops, seed);
+
+	if (generate_trace_file(num_inserts, num_deletes, num_searches, fname, type, &g, &plan) != 0) {
+		return -1;
+	}
 
 	return 0;
 }
@@ -0,0 +1,294 @@
+#ifndef _WORK_DISPATCH_H_
+#define _WORK_DISPATCH_H_
+
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+#include "threads.h"
+
+/*
+ * Hands the operations of a trace out to the worker threads.
+ *
+ * The trace is cut into batches of DISPATCH_BATCH operations, and the
+ * batches are dealt round-robin to per-thread shares before any worker
+ * starts. A worker takes the batches of its own share in order, one
+ * uncontended atomic per batch. A worker whose share is empty steals the
+ * oldest batch left in any share, until there are none left anywhere.
+ *
+ * Work that is stolen still runs close to trace order, which replaying a
+ * trace needs: an insert and a later delete of the same key have to run
+ * in that order. With more threads than cores that isn't enough, as one
+ * thread can run on its own for a whole time slice while another sits
+ * preempted in the middle of a batch. With keep_order(), no batch is
+ * started while one more than DISPATCH_WINDOW batches older is still
+ * unfinished; the thread that would start it sleeps instead. Operations
+ * further apart than that then run in trace order, whatever the scheduler
+ * does. It costs throughput whenever a thread is preempted, so it is for
+ * checking the trees, not for timing them.
+ *
+ * The operations live either in the dispatcher's own vector, added one at
+ * a time, or in an array somebody else owns, such as a mapped binary
+ * trace, which is dealt out in place.
+ */
+#define DISPATCH_BATCH			64
+#define DISPATCH_WINDOW			64
+#define DISPATCH_WAIT_US		50
+#define DISPATCH_IDLE			LONG_MAX
+
+template <class T>
+class Work_Dispatch {
+public:
+	Work_Dispatch() : items(NULL), num_items(0), range_start(0), range_end(0), num_batches(0),
+			  num_threads(0), ordered(false) {}
+
+	/*
+	 * Adding work is only allowed before seal()
+	 */
+	void put_work(const T &item)
+	{
+		storage.push_back(item);
+		items = storage.data();
+		num_items = storage.size();
+	}
+
+	/*
+	 * Hand out count operations from base instead, which has to stay put
+	 * until the workers are done with it
+	 */
+	void attach(const T *base, size_t count)
+	{
+		storage.clear();
+		items = base;
+		num_items = count;
+	}
+
+	/*
+	 * Whether to hold every thread to the window, see above. Set it before
+	 * seal().
+	 */
+	void keep_order(bool on)
+	{
+		ordered = on;
+	}
+
+	/*
+	 * Deal the batches out to threads 0 to threads - 1. Call after the last
+	 * put_work() and before any worker calls get_work(). Once the workers
+	 * are done, calling it again deals the whole trace out afresh.
+	 */
+	void seal(int threads)
+	{
+		reset_stats();
+		seal(threads, 0, num_items);
+	}
+
+	/*
+	 * The same, for only operations first to last - 1, e.g. one phase of
+	 * the trace. get_work() runs dry at last. The batch and steal counts
+	 * keep adding up from one range to the next.
+	 */
+	void seal(int threads, size_t first, size_t last)
+	{
+		num_batches = (last - first + DISPATCH_BATCH - 1) / DISPATCH_BATCH;
+		range_start = first;
+		range_end = last;
+		num_threads = threads;
+		for (int i = 0; i < num_threads; i++) {
+			workers[i].claimed.store(0, std::memory_order_relaxed);
+			workers[i].current.store(DISPATCH_IDLE, std::memory_order_relaxed);
+			workers[i].floor = 0;
+			workers[i].next = workers[i].end = NULL;
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	/**
+	 * get_work:
+	 *
+	 * Next operation for thread_num. Returns false once the whole trace
+	 * has been handed out.
+	 */
+	bool get_work(int thread_num, T *item)
+	{
+		Worker *w = &workers[thread_num];
+
+		if (w->next == w->end && !grab_batch(thread_num)) {
+			return false;
+		}
+
+		*item = *w->next++;
+		return true;
+	}
+
+	void reset_stats()
+	{
+		for (int i = 0; i < MAX_THREADS; i++) {
+			workers[i].batches = workers[i].steals = 0;
+		}
+	}
+
+	size_t size() const
+	{
+		return num_items;
+	}
+
+	void print_stats()
+	{
+		unsigned long batches = 0, steals = 0;
+
+		for (int i = 0; i < num_threads; i++) {
+			batches += workers[i].batches;
+			steals += workers[i].steals;
+		}
+
+		printf("Dispatch: %zu operations in %lu batches of up to %d, %lu batches stolen\n",
+		       num_items, batches, DISPATCH_BATCH, steals);
+	}
+
+private:
+	/*
+	 * Thread i's share is batches i, i + num_threads, i + 2 * num_threads
+	 * and so on. claimed counts how many of them are gone; the owner and
+	 * thieves both take the next one by bumping it, so a share is always
+	 * taken oldest first. current is the batch the thread is
+	 * working on, or DISPATCH_IDLE.
+	 */
+	struct alignas(CACHE_LINE_SIZE) Worker {
+		std::atomic<long> claimed;
+		std::atomic<long> current;
+		long floor;		// oldest unfinished batch, last we looked
+		const T *next;		// rest of the current batch
+		const T *end;
+		unsigned long batches;
+		unsigned long steals;
+	};
+
+	// The batch the next claim on share i would get, past the end if none
+	long next_batch(int i) const
+	{
+		return i + workers[i].claimed.load(std::memory_order_seq_cst) * num_threads;
+	}
+
+	/*
+	 * The share with the oldest batch nobody has taken, or -1 if there is
+	 * none, and in *floor the oldest batch that isn't finished yet. All the
+	 * claims are read before any current, so that a batch somebody is just
+	 * taking shows up in one or the other.
+	 */
+	int scan(long *oldest, long *floor) const
+	{
+		int share = -1;
+
+		*oldest = num_batches;
+		for (int i = 0; i < num_threads; i++) {
+			long next = next_batch(i);
+
+			if (next < *oldest) {
+				*oldest = next;
+				share = i;
+			}
+		}
+
+		*floor = *oldest;
+		for (int i = 0; i < num_threads; i++) {
+			long current = workers[i].current.load(std::memory_order_seq_cst);
+
+			if (current < *floor) {
+				*floor = current;
+			}
+		}
+		return share;
+	}
+
+	/*
+	 * Take the oldest batch left in share i for thread_num. Returns EMPTY
+	 * if there is none, or AHEAD if the order is kept and it is too far
+	 * past the oldest unfinished batch. The batch is announced as current
+	 * before the claim becomes visible, and it is checked against the
+	 * window before it is claimed, with a compare-and-swap so that it is
+	 * still the same batch when it is.
+	 */
+	long claim(int thread_num, int i)
+	{
+		Worker *w = &workers[thread_num];
+		long taken = workers[i].claimed.load(std::memory_order_seq_cst), batch;
+
+		while (true) {
+			batch = i + taken * num_threads;
+			if (batch >= num_batches || (ordered && batch - w->floor > DISPATCH_WINDOW)) {
+				w->current.store(DISPATCH_IDLE, std::memory_order_release);
+				return batch >= num_batches ? EMPTY : AHEAD;
+			}
+
+			w->current.store(batch, std::memory_order_seq_cst);
+			if (workers[i].claimed.compare_exchange_weak(taken, taken + 1,
+								     std::memory_order_seq_cst,
+								     std::memory_order_seq_cst)) {
+				return batch;
+			}
+		}
+	}
+
+	/*
+	 * Point thread_num's worker at its next batch: the next one of its own
+	 * share, or failing that the oldest batch nobody has taken. When the
+	 * order is kept and both are too far ahead, wait for the stragglers.
+	 */
+	bool grab_batch(int thread_num)
+	{
+		Worker *w = &workers[thread_num];
+		long batch, oldest;
+		int share;
+
+		// The previous batch is done
+		w->current.store(DISPATCH_IDLE, std::memory_order_release);
+
+		// The floor only moves forward, so a stale one is still a bound
+		batch = claim(thread_num, thread_num);
+		while (batch < 0) {
+			share = scan(&oldest, &w->floor);
+
+			// Everything was dealt up front, so all taken means all done
+			if (share < 0) {
+				return false;
+			}
+
+			batch = claim(thread_num, thread_num);
+			if (batch < 0) {
+				batch = claim(thread_num, share);
+				if (batch >= 0 && share != thread_num) {
+					w->steals++;
+				}
+			}
+
+			// Spinning, or even yielding, would keep the straggler off the CPU
+			if (batch == AHEAD) {
+				usleep(DISPATCH_WAIT_US);
+			}
+		}
+
+		w->next = items + range_start + batch * DISPATCH_BATCH;
+		w->end = range_start + (batch + 1) * DISPATCH_BATCH < range_end ?
+			 w->next + DISPATCH_BATCH : items + range_end;
+		w->batches++;
+		return true;
+	}
+
+	static const long EMPTY = -1;
+	static const long AHEAD = -2;
+
+	std::vector<T> storage;
+	const T *items;			// storage, or what attach() was given
+	size_t num_items;
+	size_t range_start;		// what the last seal() dealt out
+	size_t range_end;
+	long num_batches;		// in the range
+	Worker workers[MAX_THREADS];
+	int num_threads;
+	bool ordered;			// keep_order()
+};
+
+#endif